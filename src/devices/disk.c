@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -88,6 +89,7 @@ static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
 static void select_sector (struct disk *, disk_sector_t);
+static void select_sectors (struct disk *, disk_sector_t, size_t);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -251,25 +253,144 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
   //printf("READ :  memcpy from %x, to %x\n", ce->addr, buffer);
   memcpy (buffer, ce->addr, DISK_SECTOR_SIZE); 
   ce->access = true;
+  cache_count (ce);
 
 // input_sector (c, buffer);
   d->read_cnt++;
   lock_release (&c->lock);
 }
 
+/* Reads the CNT consecutive sectors starting at SEC_NO from disk
+   D into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes, with a single multi-sector command.  CNT must be between
+   1 and DISK_MULTI_MAX.  Used for bulk streaming reads, so the
+   sectors are not added to the cache, but sectors already cached
+   are returned from there, since the cached copy may be newer.
+   Internally synchronizes accesses to disks. */
+void
+disk_read_multi (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                 void *buffer_)
+{
+  struct channel *c;
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  ASSERT (d != NULL);
+  ASSERT (buffer != NULL);
+  ASSERT (cnt > 0 && cnt <= DISK_MULTI_MAX);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+
+  /* The drive interrupts as each sector becomes ready. */
+  for (i = 0; i < cnt; i++)
+  {
+    if (!wait_while_busy (d)) PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+
+    sema_down (&c->completion_wait);
+    input_sector (c, buffer + i * DISK_SECTOR_SIZE);
+  }
+
+  for (i = 0; i < cnt; i++)
+  {
+    struct cache_entry *ce = cache_lookup (d, sec_no + i);
+    if (ce != NULL)
+      memcpy (buffer + i * DISK_SECTOR_SIZE, ce->addr, DISK_SECTOR_SIZE);
+  }
+
+  d->read_cnt += cnt;
+  lock_release (&c->lock);
+}
+
+/* Reads the CNT consecutive sectors starting at SEC_NO from disk
+   D into the cache with a single multi-sector command, leaving
+   sectors that are already cached as they are.  CNT must be
+   between 1 and CACHE_PREFETCH_MAX, which keeps the entries
+   created here from evicting each other.  Unlike disk_read(),
+   does not count as an access to the sectors.
+   Internally synchronizes accesses to disks. */
+void
+disk_prefetch (struct disk *d, disk_sector_t sec_no, size_t cnt)
+{
+  static uint8_t discard[DISK_SECTOR_SIZE];
+  void *buffers[CACHE_PREFETCH_MAX];
+  struct channel *c;
+  size_t i, missing = 0;
+
+  ASSERT (d != NULL);
+  ASSERT (cnt > 0 && cnt <= CACHE_PREFETCH_MAX);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  /* Create all the entries first, since creating one may write
+     back an evicted sector, which needs the channel. */
+  for (i = 0; i < cnt; i++)
+  {
+    struct cache_entry *ce = cache_lookup (d, sec_no + i);
+    if (ce == NULL)
+    {
+      ce = cache_create (d, sec_no + i);
+      buffers[i] = ce->addr;
+      missing++;
+    }
+    else
+      buffers[i] = discard;
+  }
+
+  if (missing > 0)
+  {
+    select_sectors (d, sec_no, cnt);
+    issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+
+    for (i = 0; i < cnt; i++)
+    {
+      if (!wait_while_busy (d)) PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+
+      sema_down (&c->completion_wait);
+      input_sector (c, buffers[i]);
+    }
+    d->read_cnt += cnt;
+  }
+
+  lock_release (&c->lock);
+}
+
 void
 disk_force_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
-  //printf ("force write %s\n", buffer);
+  disk_force_write_multi (d, sec_no, 1, &buffer);
+}
+
+/* Writes the CNT consecutive sectors starting at SEC_NO of disk D
+   from BUFFERS, one sector per buffer, with a single
+   multi-sector command.  CNT must be between 1 and
+   DISK_MULTI_MAX.  Bypasses the cache; the caller must hold the
+   channel lock. */
+void
+disk_force_write_multi (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                        const void *const buffers[])
+{
   struct channel *c = d->channel;
-  select_sector (d, sec_no);
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= DISK_MULTI_MAX);
+
+  select_sectors (d, sec_no, cnt);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
 
-  if (!wait_while_busy (d)) PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+  /* The drive asks for each sector in turn and interrupts once
+     it has taken it. */
+  for (i = 0; i < cnt; i++)
+  {
+    if (!wait_while_busy (d)) PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
 
-  output_sector (c, buffer); // write del->addr to disk
-  //printf ("force write done\n");
-  sema_down (&c->completion_wait);
+    output_sector (c, buffers[i]);
+    sema_down (&c->completion_wait);
+  }
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -299,6 +420,7 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
   memcpy (ce->addr, buffer, DISK_SECTOR_SIZE);
   ce->dirty = true;
   ce->access = true;
+  cache_count (ce);
   
   //sema_down (&c->completion_wait);
 
@@ -306,6 +428,256 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/* Copies sector SRC_NO of disk D to sector DST_NO through the
+   cache, reading SRC_NO first if it is not cached, and leaves
+   DST_NO dirty.  One copy between cache slots replaces a
+   disk_read() and disk_write() through a buffer.
+   Internally synchronizes accesses to disks. */
+void
+disk_copy (struct disk *d, disk_sector_t dst_no, disk_sector_t src_no)
+{
+  struct channel *c;
+  struct cache_entry *src, *dst;
+  bool pinned;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  src = cache_lookup (d, src_no);
+  if (src == NULL)
+  {
+    src = cache_create (d, src_no);
+
+    select_sector (d, src_no);
+    issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+
+    if (!wait_while_busy (d)) PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, src_no);
+
+    sema_down (&c->completion_wait);
+    input_sector (c, src->addr);
+  }
+  src->access = true;
+  cache_count (src);
+
+  /* Keep SRC from being evicted to make room for DST. */
+  pinned = src->pinned;
+  src->pinned = true;
+  dst = cache_lookup (d, dst_no);
+  if (dst == NULL)
+    dst = cache_create (d, dst_no);
+  src->pinned = pinned;
+
+  memcpy (dst->addr, src->addr, DISK_SECTOR_SIZE);
+  dst->dirty = true;
+  dst->access = true;
+  cache_count (dst);
+
+  d->read_cnt++;
+  d->write_cnt++;
+  lock_release (&c->lock);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER immediately,
+   bypassing the write-back cache.  A cached copy of the sector,
+   if any, is updated to match and left clean.  Used for journal
+   blocks, which must be on disk before the sectors they cover. */
+void
+disk_write_through (struct disk *d, disk_sector_t sec_no, const void *buffer)
+{
+  disk_write_through_multi (d, sec_no, 1, &buffer);
+}
+
+/* Like disk_write_through(), but writes the CNT consecutive
+   sectors starting at SEC_NO from BUFFERS, one sector per buffer,
+   with a single multi-sector command.  CNT must be between 1 and
+   DISK_MULTI_MAX. */
+void
+disk_write_through_multi (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                          const void *const buffers[])
+{
+  struct channel *c;
+  size_t i;
+
+  ASSERT (d != NULL);
+  ASSERT (buffers != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  for (i = 0; i < cnt; i++)
+  {
+    struct cache_entry *ce = cache_lookup (d, sec_no + i);
+    if (ce != NULL)
+    {
+      memcpy (ce->addr, buffers[i], DISK_SECTOR_SIZE);
+      ce->dirty = false;
+    }
+  }
+
+  disk_force_write_multi (d, sec_no, cnt, buffers);
+
+  d->write_cnt += cnt;
+  lock_release (&c->lock);
+}
+
+/* Writes the cached copy of sector SEC_NO of disk D back to the
+   disk if it is dirty, so that the disk is up to date on return. */
+void
+disk_flush (struct disk *d, disk_sector_t sec_no)
+{
+  struct channel *c;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  struct cache_entry *ce = cache_lookup (d, sec_no);
+  if (ce != NULL && ce->dirty == true)
+  {
+    disk_force_write (d, sec_no, ce->addr);
+    ce->dirty = false;
+  }
+
+  lock_release (&c->lock);
+}
+
+/* Like disk_write(), but also pins the cached copy of the
+   sector.  A pinned sector stays in the cache, so it cannot be
+   written back before the journal has committed it. */
+void
+disk_write_pinned (struct disk *d, disk_sector_t sec_no, const void *buffer)
+{
+  struct channel *c;
+
+  ASSERT (d != NULL);
+  ASSERT (buffer != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  struct cache_entry *ce = cache_lookup (d, sec_no);
+  if (ce == NULL)
+    ce = cache_create (d, sec_no);
+
+  memcpy (ce->addr, buffer, DISK_SECTOR_SIZE);
+  ce->dirty = true;
+  ce->access = true;
+  ce->pinned = true;
+
+  d->write_cnt++;
+  lock_release (&c->lock);
+}
+
+/* Drops the cached copy of sector SEC_NO of disk D, if it is
+   clean and not pinned. */
+void
+disk_evict (struct disk *d, disk_sector_t sec_no)
+{
+  struct channel *c;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  struct cache_entry *ce = cache_lookup (d, sec_no);
+  if (ce != NULL && ce->dirty == false && ce->pinned == false)
+    cache_delete (d, sec_no);
+
+  lock_release (&c->lock);
+}
+
+/* Makes the cached copy of sector SEC_NO of disk D, if any, the
+   next to be evicted, as if it had not been used since it was
+   read. */
+void
+disk_cool (struct disk *d, disk_sector_t sec_no)
+{
+  struct channel *c;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  struct cache_entry *ce = cache_lookup (d, sec_no);
+  if (ce != NULL && ce->pinned == false)
+  {
+    ce->access = false;
+    list_remove (&ce->list_elem);
+    list_push_front (&cache->list, &ce->list_elem);
+  }
+
+  lock_release (&c->lock);
+}
+
+/* Writes back the cached copies of those of the CNT sectors of
+   disk D in SECTORS, which must be in ascending order, that are
+   dirty.  Runs of consecutive sectors go out as one command each.
+   Pinned sectors are left for the journal to commit.
+   Internally synchronizes accesses to disks. */
+void
+disk_sync (struct disk *d, const disk_sector_t sectors[], size_t cnt)
+{
+  struct cache_entry *run[CACHE_PREFETCH_MAX];
+  const void *buffers[CACHE_PREFETCH_MAX];
+  struct channel *c;
+  size_t i = 0, n, j;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  while (i < cnt)
+  {
+    disk_sector_t start = sectors[i];
+
+    for (n = 0; i < cnt && n < CACHE_PREFETCH_MAX && sectors[i] == start + n; n++, i++)
+    {
+      struct cache_entry *ce = cache_lookup (d, sectors[i]);
+      if (ce == NULL || ce->dirty == false || ce->pinned == true)
+        break;
+      run[n] = ce;
+      buffers[n] = ce->addr;
+    }
+
+    if (n == 0)
+    {
+      i++;
+      continue;
+    }
+
+    disk_force_write_multi (d, start, n, buffers);
+    for (j = 0; j < n; j++)
+      run[j]->dirty = false;
+    d->write_cnt += n;
+  }
+
+  lock_release (&c->lock);
+}
+
+/* Lets the cached copy of sector SEC_NO of disk D be evicted
+   again after disk_write_pinned(). */
+void
+disk_unpin (struct disk *d, disk_sector_t sec_no)
+{
+  struct channel *c;
+
+  ASSERT (d != NULL);
+
+  c = d->channel;
+  lock_acquire (&c->lock);
+
+  struct cache_entry *ce = cache_lookup (d, sec_no);
+  if (ce != NULL) ce->pinned = false;
+
+  lock_release (&c->lock);
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -475,14 +847,23 @@ print_ata_string (char *string, size_t size)
    use LBA mode.) */
 static void
 select_sector (struct disk *d, disk_sector_t sec_no) 
+{
+  select_sectors (d, sec_no, 1);
+}
+
+/* Like select_sector(), but selects the CNT sectors starting at
+   SEC_NO for a multi-sector command. */
+static void
+select_sectors (struct disk *d, disk_sector_t sec_no, size_t cnt) 
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < d->capacity);
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (sec_no + cnt <= d->capacity);
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= DISK_MULTI_MAX);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
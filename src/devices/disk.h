@@ -2,6 +2,8 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Size of a disk sector in bytes. */
@@ -15,13 +17,30 @@ typedef uint32_t disk_sector_t;
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors transferred by one multi-sector command. */
+#define DISK_MULTI_MAX 255
+
 void disk_init (void);
 void disk_print_stats (void);
 
 struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
+void disk_read_multi (struct disk *, disk_sector_t, size_t, void *);
+void disk_prefetch (struct disk *, disk_sector_t, size_t);
 void disk_force_write (struct disk *d, disk_sector_t sec_no, const void *buffer);
+void disk_force_write_multi (struct disk *, disk_sector_t, size_t,
+                             const void *const[]);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_write_through (struct disk *, disk_sector_t, const void *);
+void disk_write_through_multi (struct disk *, disk_sector_t, size_t,
+                               const void *const[]);
+void disk_copy (struct disk *, disk_sector_t dst, disk_sector_t src);
+void disk_flush (struct disk *, disk_sector_t);
+void disk_sync (struct disk *, const disk_sector_t[], size_t);
+void disk_write_pinned (struct disk *, disk_sector_t, const void *);
+void disk_unpin (struct disk *, disk_sector_t);
+void disk_evict (struct disk *, disk_sector_t);
+void disk_cool (struct disk *, disk_sector_t);
 
 #endif /* devices/disk.h */
@@ -24,6 +24,11 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
+  /* Try a copy-on-write clone, which shares the data instead of
+     copying it. */
+  if (clone (in_fd, argv[2]))
+    return EXIT_SUCCESS;
+
   /* Create and open output file. */
   if (!create (argv[2], filesize (in_fd))) 
     {
@@ -37,7 +42,15 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
-  /* Copy data. */
+  /* Copy data inside the kernel. */
+  for (;;)
+    {
+      int bytes_copied = copy_range (in_fd, out_fd, 65536);
+      if (bytes_copied <= 0)
+        break;
+    }
+
+  /* Copy whatever is left through a buffer. */
   for (;;) 
     {
       char buffer[1024];
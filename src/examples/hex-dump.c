@@ -20,14 +20,15 @@ main (int argc, char *argv[])
           success = false;
           continue;
         }
+      int pos = 0;
       for (;;) 
         {
           char buffer[1024];
-          int pos = tell (fd);
-          int bytes_read = read (fd, buffer, sizeof buffer);
-          if (bytes_read == 0)
+          int bytes_read = pread (fd, buffer, sizeof buffer, pos);
+          if (bytes_read <= 0)
             break;
           hex_dump (pos, buffer, bytes_read, true);
+          pos += bytes_read;
         }
       close (fd);
     }
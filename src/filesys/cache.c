@@ -1,6 +1,46 @@
 #include "filesys/cache.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "vm/swap.h"
 
+/* Most sectors written back together by cache_write_back(). */
+#define CLUSTER_MAX 16
+
+static void cache_write_back (struct cache_entry *);
+
+/* Access counts, used to pick the sectors worth warming up at
+   the next boot.  Kept apart from the cache entries so that
+   counts survive eviction, in a table direct-mapped by sector
+   number.  An access to a sector that maps to another sector's
+   slot wears that sector's count down and takes over the slot
+   once it reaches zero, so steadily used sectors keep their
+   slots against one-off accesses.  The counts are only a hint,
+   so accesses racing on two channels may at worst be lost. */
+#define HEAT_SIZE 1024
+
+struct heat
+{
+    struct disk *disk;
+    disk_sector_t disk_no;
+    unsigned count;
+};
+
+static struct heat heat[HEAT_SIZE];
+
+/* Sectors being prefetched by prefetch_thread(). */
+static struct disk *prefetch_disk;
+static disk_sector_t prefetch_sectors[CACHE_SIZE];
+static size_t prefetch_cnt;
+
+/* Held by prefetch_thread() while it runs. */
+static struct lock prefetch_lock;
+static bool prefetch_cancel;
+
+static void prefetch_thread (void *aux);
+
 unsigned
 cache_hash (const struct hash_elem *c_, void *aux UNUSED)
 {
@@ -28,6 +68,7 @@ cache_init ()
   cache->bitmap = bitmap_create ((size_t) CACHE_SIZE);
   hash_init (&cache->hash, cache_hash, cache_less, NULL);
   list_init (&cache->list); 
+  lock_init (&prefetch_lock);
 }
 
 void cache_destroy ()
@@ -35,6 +76,11 @@ void cache_destroy ()
   struct list_elem *e;
   struct cache_entry *ce;
 
+  /* Wait for a running prefetch to stop. */
+  prefetch_cancel = true;
+  lock_acquire (&prefetch_lock);
+  lock_release (&prefetch_lock);
+
   while (list_empty (&cache->list) == false)
   {
     e = list_front (&cache->list);
@@ -59,7 +105,7 @@ struct cache_entry *cache_create (struct disk *disk, disk_sector_t disk_no)
       struct list_elem *e = list_pop_front (&cache->list);
       struct cache_entry *ce = list_entry (e, struct cache_entry, list_elem);
 
-      if (ce->access == true)
+      if (ce->access == true || ce->pinned == true)
       {
         ce->access = false;
         list_push_back (&cache->list, &ce->list_elem);
@@ -86,6 +132,7 @@ struct cache_entry *cache_create (struct disk *disk, disk_sector_t disk_no)
 
   ce->dirty = false;
   ce->access = true;
+  ce->pinned = false;
 
   hash_insert (&cache->hash, &ce->hash_elem);
   list_push_back (&cache->list, &ce->list_elem);
@@ -128,7 +175,7 @@ void cache_delete (struct disk *disk, disk_sector_t disk_no)
   if (del->dirty == true)
   {
 //    printf("dirty\n");
-    disk_force_write (del->disk, del->disk_no, del->addr);
+    cache_write_back (del);
 //    printf("force write done\n");
   }
 
@@ -138,3 +185,167 @@ void cache_delete (struct disk *disk, disk_sector_t disk_no)
 
   free (del);
 }  
+
+/* Writes dirty entry CE back to disk along with the dirty cached
+   sectors on either side of it, as one multi-sector command, and
+   marks them all clean.  Sectors written in a row (file data from
+   an allocation window, or the log head in log mode) thus reach
+   the disk in one transfer.  Pinned sectors are skipped, since
+   the journal has not committed them yet. */
+static void
+cache_write_back (struct cache_entry *ce)
+{
+  struct cache_entry *run[CLUSTER_MAX];
+  const void *buffers[CLUSTER_MAX];
+  struct cache_entry *e;
+  disk_sector_t first = ce->disk_no;
+  size_t cnt, i;
+
+  while (ce->disk_no - first < CLUSTER_MAX / 2 && first > 0
+         && (e = cache_lookup (ce->disk, first - 1)) != NULL
+         && e->dirty == true && e->pinned == false)
+    first--;
+
+  for (cnt = 0; cnt < CLUSTER_MAX; cnt++)
+  {
+    e = cache_lookup (ce->disk, first + cnt);
+    if (e == NULL || e->dirty == false || (e->pinned == true && e != ce))
+      break;
+    run[cnt] = e;
+    buffers[cnt] = e->addr;
+  }
+
+  ASSERT (first + cnt > ce->disk_no);
+
+  disk_force_write_multi (ce->disk, first, cnt, buffers);
+  for (i = 0; i < cnt; i++)
+    run[i]->dirty = false;
+}
+
+/* Counts an access to cached sector CE in the heat table. */
+void
+cache_count (struct cache_entry *ce)
+{
+  struct heat *h = &heat[ce->disk_no % HEAT_SIZE];
+
+  if (h->disk == ce->disk && h->disk_no == ce->disk_no)
+  {
+    if (h->count < UINT_MAX)
+      h->count++;
+  }
+  else if (h->count > 0)
+    h->count--;
+  else
+  {
+    h->disk = ce->disk;
+    h->disk_no = ce->disk_no;
+    h->count = 1;
+  }
+}
+
+/* Orders disk sector numbers for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const disk_sector_t *a = a_;
+  const disk_sector_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Stores in SECTORS the numbers of the up to MAX most frequently
+   accessed sectors of DISK, in ascending order, and returns how
+   many were stored.  MAX must not exceed CACHE_SIZE, since more
+   sectors could not be cached at once anyway. */
+size_t
+cache_hot_sectors (struct disk *disk, disk_sector_t sectors[], size_t max)
+{
+  unsigned counts[CACHE_SIZE];
+  size_t cnt = 0;
+  size_t i, j;
+
+  ASSERT (max <= CACHE_SIZE);
+
+  /* Keep SECTORS ordered by descending count while scanning. */
+  for (i = 0; i < HEAT_SIZE; i++)
+  {
+    struct heat *h = &heat[i];
+
+    if (h->disk != disk || h->count == 0
+        || (cnt == max && (cnt == 0 || h->count <= counts[cnt - 1])))
+      continue;
+
+    if (cnt < max)
+      cnt++;
+    for (j = cnt - 1; j > 0 && counts[j - 1] < h->count; j--)
+    {
+      counts[j] = counts[j - 1];
+      sectors[j] = sectors[j - 1];
+    }
+    counts[j] = h->count;
+    sectors[j] = h->disk_no;
+  }
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  return cnt;
+}
+
+/* Stores in SECTORS, which must have room for CACHE_SIZE
+   entries, the numbers of the cached sectors of DISK that are
+   dirty and not pinned, in ascending order, and returns how many
+   there are. */
+size_t
+cache_dirty_sectors (struct disk *disk, disk_sector_t sectors[])
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  for (e = list_begin (&cache->list); e != list_end (&cache->list);
+       e = list_next (e))
+  {
+    struct cache_entry *ce = list_entry (e, struct cache_entry, list_elem);
+    if (ce->disk == disk && ce->dirty == true && ce->pinned == false)
+      sectors[cnt++] = ce->disk_no;
+  }
+
+  qsort (sectors, cnt, sizeof *sectors, compare_sectors);
+  return cnt;
+}
+
+/* Starts reading the CNT sectors of DISK in SECTORS, which must
+   be in ascending order, into the cache in the background.
+   Consecutive sectors are read with one command.  CNT must not
+   exceed CACHE_SIZE. */
+void
+cache_prefetch (struct disk *disk, const disk_sector_t sectors[], size_t cnt)
+{
+  ASSERT (cnt <= CACHE_SIZE);
+
+  if (cnt == 0)
+    return;
+
+  prefetch_disk = disk;
+  memcpy (prefetch_sectors, sectors, cnt * sizeof *sectors);
+  prefetch_cnt = cnt;
+  prefetch_cancel = false;
+  thread_create ("prefetch", PRI_DEFAULT, prefetch_thread, NULL);
+}
+
+/* Reads the sectors set up by cache_prefetch() into the cache,
+   in runs of consecutive sectors, until done or cancelled by
+   cache_destroy(). */
+static void
+prefetch_thread (void *aux UNUSED)
+{
+  size_t i, n;
+
+  lock_acquire (&prefetch_lock);
+  for (i = 0; i < prefetch_cnt && prefetch_cancel == false; i += n)
+  {
+    for (n = 1; i + n < prefetch_cnt && n < CACHE_PREFETCH_MAX
+                && prefetch_sectors[i + n] == prefetch_sectors[i] + n; n++)
+      continue;
+    disk_prefetch (prefetch_disk, prefetch_sectors[i], n);
+  }
+  lock_release (&prefetch_lock);
+}
@@ -6,6 +6,9 @@
 
 #define CACHE_SIZE 64
 
+/* Most sectors read into the cache by one disk_prefetch(). */
+#define CACHE_PREFETCH_MAX (CACHE_SIZE / 4)
+
 struct cache_entry
 {
     struct disk *disk;
@@ -14,6 +17,7 @@ struct cache_entry
 
     bool dirty;
     bool access;
+    bool pinned;    /* Logged by the journal, must not be evicted. */
 
     struct hash_elem hash_elem;
     struct list_elem list_elem;
@@ -38,3 +42,8 @@ struct cache_entry *cache_create (struct disk *disk, disk_sector_t disk_no);
 struct cache_entry *cache_lookup (struct disk* disk, disk_sector_t disk_no);
 void cache_delete (struct disk *disk, disk_sector_t disk_no);
 
+void cache_count (struct cache_entry *ce);
+size_t cache_hot_sectors (struct disk *disk, disk_sector_t sectors[], size_t max);
+void cache_prefetch (struct disk *disk, const disk_sector_t sectors[], size_t cnt);
+size_t cache_dirty_sectors (struct disk *disk, disk_sector_t sectors[]);
+
@@ -26,7 +26,7 @@ struct dir_entry
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) 
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), TYPE_DIRECTORY);
+  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), TYPE_DIRECTORY, 0);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -271,3 +271,56 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Entries read from disk at once by dir_readdir_plus(). */
+#define READDIR_BATCH (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Reads up to MAX in-use entries of DIR, other than "." and "..",
+   starting at DIR's position, into INFOS together with each
+   entry's inode number, type and length.  Reads the directory's
+   entries a sector's worth at a time rather than one by one.
+   Returns the number of entries stored, 0 at the end of DIR. */
+size_t
+dir_readdir_plus (struct dir *dir, struct dir_info infos[], size_t max)
+{
+  struct dir_entry *entries;
+  size_t cnt = 0;
+
+  entries = malloc (READDIR_BATCH * sizeof *entries);
+  if (entries == NULL)
+    return 0;
+
+  while (cnt < max)
+    {
+      off_t n = inode_read_at (dir->inode, entries,
+                               READDIR_BATCH * sizeof *entries, dir->pos);
+      size_t i;
+
+      if (n < (off_t) sizeof *entries)
+        break;
+
+      for (i = 0; i < n / sizeof *entries && cnt < max; i++)
+        {
+          struct dir_entry *e = &entries[i];
+          struct dir_info *info = &infos[cnt];
+          struct inode *inode;
+
+          dir->pos += sizeof *e;
+          if (!e->in_use || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+            continue;
+
+          inode = inode_open (e->inode_sector);
+          if (inode == NULL)
+            continue;
+          info->inumber = e->inode_sector;
+          info->length = inode_length (inode);
+          info->is_dir = inode_get_type (inode) == TYPE_DIRECTORY;
+          strlcpy (info->name, e->name, sizeof info->name);
+          inode_close (inode);
+          cnt++;
+        }
+    }
+
+  free (entries);
+  return cnt;
+}
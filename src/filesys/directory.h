@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/disk.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -13,6 +14,17 @@
 
 struct inode;
 
+/* A directory entry with its inode's metadata, as returned by
+   dir_readdir_plus().  Laid out as struct readdir_entry in
+   lib/user/syscall.h. */
+struct dir_info
+  {
+    disk_sector_t inumber;              /* Inode sector. */
+    off_t length;                       /* Size in bytes. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool is_dir;                        /* Directory? */
+  };
+
 /* Opening and closing directories. */
 bool dir_create (disk_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -27,5 +39,6 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, disk_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_plus (struct dir *, struct dir_info[], size_t max);
 
 #endif /* filesys/directory.h */
@@ -1,16 +1,31 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
+#include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead windows, in sectors. */
+#define READAHEAD_NORMAL 4
+#define READAHEAD_SEQUENTIAL CACHE_PREFETCH_MAX
+
+/* Sectors prefetched at once for ADVICE_WILLNEED. */
+#define WILLNEED_SECTORS (CACHE_SIZE / 2)
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    enum file_advice advice;    /* Access hint from file_advise(). */
+    off_t ra_last;              /* End of the previous read. */
+    off_t ra_end;               /* End of the read-ahead so far. */
   };
 
+static void readahead (struct file *, off_t offset, off_t size);
+
 
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
@@ -24,6 +39,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->advice = ADVICE_NORMAL;
       return file;
     }
   else
@@ -70,6 +86,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,7 +99,51 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  readahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Acts on SIZE bytes just read from FILE at OFFSET according to
+   FILE's access hint: keeps a read-ahead window of cached sectors
+   past sequential reads, or cools what was read for
+   ADVICE_NOREUSE.  The window is refilled once less than half of
+   it is left, so steady sequential reads issue one multi-sector
+   prefetch per half window. */
+static void
+readahead (struct file *file, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  off_t window;
+
+  switch (file->advice)
+  {
+    case ADVICE_SEQUENTIAL:
+      window = READAHEAD_SEQUENTIAL * DISK_SECTOR_SIZE;
+      break;
+    case ADVICE_NORMAL:
+      window = offset == file->ra_last ? READAHEAD_NORMAL * DISK_SECTOR_SIZE : 0;
+      break;
+    case ADVICE_NOREUSE:
+      inode_cool (file->inode, offset, size);
+      /* Fall through. */
+    default:
+      window = 0;
+      break;
+  }
+  file->ra_last = end;
+  if (window == 0 || size == 0)
+    return;
+
+  /* Restart the window after a seek. */
+  if (file->ra_end < end || file->ra_end > end + 2 * window)
+    file->ra_end = ROUND_UP (end, DISK_SECTOR_SIZE);
+
+  if (file->ra_end - end < window / 2)
+  {
+    inode_prefetch (file->inode, file->ra_end, window / DISK_SECTOR_SIZE);
+    file->ra_end += window;
+  }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -114,6 +175,57 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, to DST at its current position, inside the kernel.
+   Returns the number of bytes copied, which may be less than
+   SIZE at the end of SRC or if the disk fills up, and advances
+   both positions by that much. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  off_t bytes_copied = inode_copy (dst->inode, dst->pos,
+                                   src->inode, src->pos, size);
+  dst->pos += bytes_copied;
+  src->pos += bytes_copied;
+  return bytes_copied;
+}
+
+/* Reserves disk space for SIZE bytes of FILE starting at offset
+   FILE_OFS, growing the file if needed, so that later writes to
+   that range do not have to allocate.
+   Returns true if successful, false otherwise.
+   The file's current position is unaffected. */
+bool
+file_preallocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_preallocate (file->inode, file_ofs, size);
+}
+
+/* Sets the access hint for FILE to ADVICE.  ADVICE_WILLNEED
+   prefetches data from the current position at once, and
+   ADVICE_DONTNEED drops the file's clean data from the cache;
+   neither changes the hint in effect.  The others govern
+   read-ahead and cache retention for later reads. */
+void
+file_advise (struct file *file, enum file_advice advice)
+{
+  ASSERT (file != NULL);
+
+  switch (advice)
+  {
+    case ADVICE_WILLNEED:
+      inode_prefetch (file->inode, file->pos, WILLNEED_SECTORS);
+      break;
+    case ADVICE_DONTNEED:
+      inode_drop_cache (file->inode);
+      break;
+    default:
+      file->advice = advice;
+      file->ra_end = 0;
+      break;
+  }
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -6,6 +6,17 @@
 
 struct inode;
 
+/* Access hints for file_advise(). */
+enum file_advice
+  {
+    ADVICE_NORMAL,              /* Modest read-ahead when sequential. */
+    ADVICE_SEQUENTIAL,          /* Read in order: large read-ahead. */
+    ADVICE_RANDOM,              /* Read in no order: no read-ahead. */
+    ADVICE_WILLNEED,            /* Read soon: prefetch now. */
+    ADVICE_DONTNEED,            /* Not read soon: drop cached data. */
+    ADVICE_NOREUSE              /* Read once: keep cached data cold. */
+  };
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -17,6 +28,9 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
+bool file_preallocate (struct file *, off_t start, off_t size);
+void file_advise (struct file *, enum file_advice);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
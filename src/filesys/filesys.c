@@ -8,17 +8,21 @@
 #include "filesys/directory.h"
 #include "devices/disk.h"
 #include "filesys/cache.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "userprog/syscall.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
-static void do_format (void);
+static void do_format (bool log);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system, with the
+   log-structured layout if LOG is true. */
 void
-filesys_init (bool format) 
+filesys_init (bool format, bool log) 
 {
   filesys_disk = disk_get (0, 1);
   if (filesys_disk == NULL)
@@ -26,12 +30,21 @@ filesys_init (bool format)
 
   inode_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
-    do_format ();
+    do_format (log);
 
   free_map_open ();
 
+  /* Warm up the cache with the sectors that were hottest when
+     the file system was last shut down. */
+  if (!format)
+  {
+    disk_sector_t warm[FREE_MAP_WARMUP_MAX];
+    cache_prefetch (filesys_disk, warm, free_map_warmup (warm));
+  }
+
   dir_add (dir_open_root (), ".", ROOT_DIR_SECTOR);
   dir_add (dir_open_root (), "..", ROOT_DIR_SECTOR);
 
@@ -43,12 +56,30 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  disk_sector_t hot[FREE_MAP_WARMUP_MAX];
+
+  /* Also waits for the reclaim thread, which must not touch the
+     free map after free_map_close(). */
+  inode_reclaim ();
+  inode_flush_all ();
+  free_map_set_warmup (hot, cache_hot_sectors (filesys_disk, hot,
+                                               FREE_MAP_WARMUP_MAX));
+  journal_flush ();             /* Frees sectors from journal_release(). */
   free_map_close ();
+  journal_flush ();
   cache_destroy ();
 }
 
-struct dir*
-name_to_dir (const char *name, char *file_name, disk_sector_t *parent)
+/* Resolves all but the last component of NAME, relative to BASE
+   if NAME is relative, or to the current directory if BASE is
+   null.  Stores the last component in FILE_NAME and returns the
+   directory that holds it, which the caller must close.  If
+   PARENT is nonnull, stores the directory's inode sector there.
+   Returns a null pointer if a directory along the way does not
+   exist. */
+static struct dir*
+name_to_dir_at (struct dir *base, const char *name, char *file_name,
+                disk_sector_t *parent)
 {
   int i;
   bool isRoot = true;
@@ -78,7 +109,7 @@ name_to_dir (const char *name, char *file_name, disk_sector_t *parent)
   struct dir *cd;
   
   if (name[0] == '/') cd = dir_open_root ();
-  else cd = dir_reopen (thread_current ()->cwd);
+  else cd = dir_reopen (base != NULL ? base : thread_current ()->cwd);
 
   char *tmp = palloc_get_page (0);
   strlcpy (tmp, name, strlen (name) + 1);
@@ -119,18 +150,62 @@ name_to_dir (const char *name, char *file_name, disk_sector_t *parent)
 }
 
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
+/* Writes all unwritten file system data to disk: open inodes,
+   dirty cached sectors in ascending order, and then the journal,
+   leaving the file system running. */
+void
+filesys_sync (void)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  disk_sector_t *sectors = malloc (CACHE_SIZE * sizeof *sectors);
+
+  inode_flush_all ();
+  if (sectors != NULL)
+  {
+    disk_sync (filesys_disk, sectors, cache_dirty_sectors (filesys_disk, sectors));
+    free (sectors);
+  }
+  journal_flush ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+struct dir*
+name_to_dir (const char *name, char *file_name, disk_sector_t *parent)
+{
+  return name_to_dir_at (NULL, name, file_name, parent);
+}
+
+
+/* Creates a file named NAME with the given INITIAL_SIZE and
+   inode_create() FLAGS.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
 bool
-filesys_create (const char *name, off_t initial_size) 
+filesys_create (const char *name, off_t initial_size, unsigned flags) 
+{
+  return filesys_create_at (NULL, name, initial_size, flags);
+}
+
+/* Like filesys_create(), but resolves a relative NAME from
+   directory BASE instead of the current directory.  A null BASE
+   means the current directory. */
+bool
+filesys_create_at (struct dir *base, const char *name, off_t initial_size,
+                   unsigned flags)
 {
   if (strlen (name) > MAX_CWD_LENGTH) return false;
 
   disk_sector_t inode_sector = 0;
   char *file_name = (char *)malloc (NAME_MAX+1);
-  struct dir *dir = name_to_dir (name, file_name, NULL);
+  struct dir *dir = name_to_dir_at (base, name, file_name, NULL);
 
   if (dir == NULL) 
   {
@@ -138,12 +213,62 @@ filesys_create (const char *name, off_t initial_size)
     return false;
   }
    
+  journal_begin ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, TYPE_FILE)
+                  && free_map_allocate_inode (&inode_sector)
+                  && inode_create (inode_sector, initial_size, TYPE_FILE, flags)
                   && dir_add (dir, file_name, inode_sector));
   if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+    free_map_release_inode (inode_sector);
+  journal_end ();
+
+  dir_close (dir);
+  free(file_name);
+
+  return success;
+}
+
+/* Creates a file named NAME as a clone of file inode SRC,
+   sharing its data sectors until either file is written.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists, if SRC is a
+   directory, or if internal memory allocation fails. */
+bool
+filesys_clone (struct inode *src, const char *name)
+{
+  if (strlen (name) > MAX_CWD_LENGTH) return false;
+
+  disk_sector_t inode_sector = 0;
+  char *file_name = (char *)malloc (NAME_MAX+1);
+  struct dir *dir = name_to_dir (name, file_name, NULL);
+
+  if (dir == NULL) 
+  {
+    free (file_name);
+    return false;
+  }
+
+  /* inode_clone() commits in steps of its own, which an enclosing
+     transaction would hold open, so only the directory entry gets
+     one here.  A crash before it leaks the clone's blocks. */
+  bool success = (free_map_allocate_inode (&inode_sector)
+                  && inode_clone (src, inode_sector));
+  if (success)
+  {
+    journal_begin ();
+    success = dir_add (dir, file_name, inode_sector);
+    journal_end ();
+
+    if (!success)
+    {
+      /* Let the last close free the clone's blocks. */
+      struct inode *inode = inode_open (inode_sector);
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  }
+  else if (inode_sector != 0) 
+    free_map_release_inode (inode_sector);
 
   dir_close (dir);
   free(file_name);
@@ -158,11 +283,20 @@ filesys_create (const char *name, off_t initial_size)
    or if an internal memory allocation fails. */
 void *
 filesys_open (const char *name, bool *is_dir)
+{
+  return filesys_open_at (NULL, name, is_dir);
+}
+
+/* Like filesys_open(), but resolves a relative NAME from
+   directory BASE instead of the current directory.  A null BASE
+   means the current directory. */
+void *
+filesys_open_at (struct dir *base, const char *name, bool *is_dir)
 {
   if (strcmp (name, "") == 0) return NULL;
 
   char *file_name = (char *)malloc (NAME_MAX+1);
-  struct dir *dir = name_to_dir (name, file_name, NULL);
+  struct dir *dir = name_to_dir_at (base, name, file_name, NULL);
 
   //if (dir == NULL || strcmp (file_name, ".") == 0 || strcmp (file_name, "..") == 0) 
   if (dir == NULL ) 
@@ -209,9 +343,18 @@ filesys_open (const char *name, bool *is_dir)
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
+{
+  return filesys_remove_at (NULL, name);
+}
+
+/* Like filesys_remove(), but resolves a relative NAME from
+   directory BASE instead of the current directory.  A null BASE
+   means the current directory. */
+bool
+filesys_remove_at (struct dir *base, const char *name)
 {
   char *file_name = (char *)malloc (NAME_MAX);
-  struct dir *dir = name_to_dir (name, file_name, NULL);
+  struct dir *dir = name_to_dir_at (base, name, file_name, NULL);
 
   if (dir == NULL) 
   {
@@ -220,8 +363,10 @@ filesys_remove (const char *name)
     return false;
   }
 
+  journal_begin ();
   bool success = dir != NULL && dir_remove (dir, file_name);
   dir_close (dir); 
+  journal_end ();
   free (file_name);
 
   return success;
@@ -267,11 +412,20 @@ filesys_chdir (const char *name)
 
 bool
 filesys_mkdir (const char *name)
+{
+  return filesys_mkdir_at (NULL, name);
+}
+
+/* Like filesys_mkdir(), but resolves a relative NAME from
+   directory BASE instead of the current directory.  A null BASE
+   means the current directory. */
+bool
+filesys_mkdir_at (struct dir *base, const char *name)
 {
   disk_sector_t inode_sector = 0;
   char *file_name = (char *)malloc (NAME_MAX);
   disk_sector_t parent;  // not NULL
-  struct dir *dir = name_to_dir (name, file_name, &parent);
+  struct dir *dir = name_to_dir_at (base, name, file_name, &parent);
 
   if (dir == NULL) 
   {
@@ -280,13 +434,14 @@ filesys_mkdir (const char *name)
     return false;
   }
 
+  journal_begin ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_inode (&inode_sector)
                   && dir_create (inode_sector, 0)
                   && dir_add (dir, file_name, inode_sector));
 
   if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
+    free_map_release_inode (inode_sector);
 
   else
   {
@@ -294,6 +449,7 @@ filesys_mkdir (const char *name)
     dir_lookup (dir, file_name, &inode);
     if (inode == NULL)
     {
+      journal_end ();
       dir_close(dir);
       free(file_name);
       return false;
@@ -305,6 +461,7 @@ filesys_mkdir (const char *name)
     dir_add (new, "..", parent);
     dir_close(new);
   }
+  journal_end ();
 
   dir_close (dir);
   free(file_name);
@@ -331,12 +488,13 @@ filesys_readdir (struct dir *dir, char *name)
 
 /* Formats the file system. */
 static void
-do_format (void)
+do_format (bool log)
 {
-  printf ("Formatting file system...");
-  free_map_create ();
+  printf ("Formatting file system%s...", log ? " (log-structured)" : "");
+  free_map_create (log);
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  journal_flush ();
   printf ("done.\n");
 }
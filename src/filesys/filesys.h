@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 
+struct inode;
+struct dir;
+
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
@@ -11,14 +14,23 @@
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
-void filesys_init (bool format);
+void filesys_init (bool format, bool log);
 void filesys_done (void);
-bool filesys_create (const char *name, off_t initial_size);
+void filesys_sync (void);
+bool filesys_create (const char *name, off_t initial_size, unsigned flags);
+bool filesys_clone (struct inode *src, const char *name);
 void *filesys_open (const char *name, bool *is_dir);
 bool filesys_remove (const char *name);
 bool filesys_chdir (const char *name);
 bool filesys_mkdir (const char *name);
 bool filesys_readdir (struct dir *dir, char *name);
 
+/* Variants resolving relative names from a given directory. */
+bool filesys_create_at (struct dir *base, const char *name,
+                        off_t initial_size, unsigned flags);
+void *filesys_open_at (struct dir *base, const char *name, bool *is_dir);
+bool filesys_remove_at (struct dir *base, const char *name);
+bool filesys_mkdir_at (struct dir *base, const char *name);
+
 
 #endif /* filesys/filesys.h */
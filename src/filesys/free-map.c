@@ -1,15 +1,184 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <stdint.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "userprog/syscall.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Range of free_map bits changed since the last map_write(), so
+   that an update writes only the free map sectors it touched. */
+static size_t map_lo, map_hi;
+static bool map_dirty;
+
+/* Free map bits per sector of the free map file. */
+#define MAP_SECTOR_BITS (DISK_SECTOR_SIZE * 8)
+
+/* Most free map and reference count sectors that one transaction
+   of free_map_release_batch() or free_map_share() writes, well
+   within JOURNAL_TXN_MAX. */
+#define SPLIT_SECTORS 4
+
+/* Identifies a superblock. */
+#define SUPER_MAGIC 0x53555052
+
+/* Superblock, recording the layout chosen at format time.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct super_block
+  {
+    unsigned magic;                     /* Magic number. */
+    unsigned log;                       /* Log-structured layout? */
+    disk_sector_t log_head;             /* Next sector to allocate. */
+    unsigned refcount;                  /* Reference count file exists? */
+    unsigned warmup_cnt;                /* Entries in warmup[]. */
+    disk_sector_t warmup[FREE_MAP_WARMUP_MAX]; /* Sectors to prefetch. */
+    disk_sector_t log_start;            /* First sector of the log. */
+    disk_sector_t imap;                 /* Inode map's inode sector. */
+    uint8_t unused[DISK_SECTOR_SIZE - 4 * sizeof (unsigned)
+                   - (3 + FREE_MAP_WARMUP_MAX) * sizeof (disk_sector_t)];
+  };
+
+static struct super_block super;     /* In-memory superblock. */
+
+/* Reference counts for sectors shared between cloned files.
+   Byte N counts the owners of sector N beyond the first, so an
+   ordinary sector has 0.  Kept in the file whose inode is at
+   REFCOUNT_SECTOR, null if the disk predates clones, and paged
+   through the buffer cache one block at a time: only the block
+   in refcount_block is held here. */
+static struct file *refcount_file;
+static uint8_t refcount_block[DISK_SECTOR_SIZE];
+static off_t refcount_ofs = -1;      /* File offset of refcount_block. */
+static bool refcount_dirty;          /* refcount_block changed? */
+static int refcount_loads;           /* Blocks read since split_check(). */
+
+/* Log-structured layout.
+
+   The disk past the files created at format time is divided into
+   segments of SEGMENT_SECTORS sectors.  Every allocation comes
+   from the log head, which fills one segment front to back and
+   then moves on to the next clean (entirely free) one, so writes
+   reach the buffer cache in ascending order and go to disk in
+   multi-sector runs.
+
+   A regular file is never updated in place once committed.  Its
+   overwritten data, the index blocks above that data and its
+   inode are written to new sectors at the head, and the old ones
+   go to journal_release().  Sectors allocated since the last
+   commit are "fresh" (free_map_fresh()): nothing committed points
+   at them yet, so inode.c rewrites them in place, and a burst of
+   writes to one file moves each of its index blocks and its
+   inode once per commit, not once per write.  Every commit
+   starts with free_map_sync_log(), which writes the fresh sectors
+   back before the metadata that points at them.
+
+   Because inodes move, directories name them by inode number.
+   The inode map, a file preallocated at format time, holds the
+   current sector of each number.  Numbers from the map start at
+   the disk size, so they never clash with the inodes at fixed
+   sectors, such as the root directory and the files kept here.
+   Directories, like those files, are metadata and are updated in
+   place through the journal once written.
+
+   The first sector of each segment is its summary: for each of
+   the segment's other sectors, the inode number and block (see
+   inode.c) last allocated there.  When fewer than CLEAN_LOW
+   segments are clean, the cleaner thread takes the segment with
+   the fewest live sectors, moves each of them to the head with
+   inode_move_block(), which checks the summary against the
+   owner's index, and commits, which frees the whole segment.
+   Sectors it cannot move, such as compressed runs and sectors
+   shared with a clone, keep their segment until the next pass.
+   Only when no segment is clean does allocation fall back to
+   free sectors anywhere in the log.
+
+   The inode map, the free map and the superblock all change
+   through the journal, so every commit leaves them consistent
+   with one another.  The superblock is the checkpoint of the log
+   head: it is logged whenever the head moves to a new segment and
+   after each segment is cleaned, so after a crash allocation
+   resumes in the segment the log was filling. */
+
+/* Sectors per log segment, the first of them its summary. */
+#define SEGMENT_SECTORS 64
+
+/* The cleaner runs when fewer than CLEAN_LOW segments are clean
+   and stops once CLEAN_HIGH are.  It leaves alone segments with
+   more than CLEAN_LIVE_MAX live sectors, where moving them would
+   gain little. */
+#define CLEAN_LOW 4
+#define CLEAN_HIGH 8
+#define CLEAN_LIVE_MAX (SEGMENT_SECTORS * 3 / 4)
+
+/* Disk sectors per inode map entry. */
+#define IMAP_RATIO 8
+
+/* Inode map entry of a number handed out by
+   free_map_allocate_inode() whose inode is not written yet.
+   Never written to disk. */
+#define IMAP_RESERVED ((disk_sector_t) -1)
+
+/* No segment. */
+#define NO_SEGMENT SIZE_MAX
+
+/* Owner of a sector in a log segment. */
+struct summary_entry
+  {
+    disk_sector_t inumber;              /* Inode number, 0 if none. */
+    unsigned block;                     /* Block of that inode. */
+  };
+
+/* Log segment summary, the first sector of each segment.  Entry
+   0, for the summary itself, is unused.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct segment_summary
+  {
+    struct summary_entry entries[SEGMENT_SECTORS];
+  };
+
+static size_t seg_cnt;               /* Segments, 0 if not in log mode. */
+static disk_sector_t log_end;        /* End of the last segment. */
+static size_t cur_seg = NO_SEGMENT;  /* Segment the head is filling. */
+static size_t victim = NO_SEGMENT;   /* Segment being cleaned. */
+static disk_sector_t hole_next;      /* Where the fallback resumes. */
+static struct segment_summary summary; /* For free_map_set_owner(). */
+
+/* Sectors allocated since the last commit, within
+   fresh_lo...fresh_hi if fresh_any. */
+static struct bitmap *fresh_map;
+static disk_sector_t fresh_lo, fresh_hi;
+static bool fresh_any;
+
+/* Inode map, read in whole, and the file it is kept in.  Entry
+   N gives the sector of inode number disk_size() + N, or 0 if
+   the number is free.  No entry below imap_hint is free. */
+static struct file *imap_file;
+static disk_sector_t *imap;
+static size_t imap_cnt;
+static size_t imap_hint;
+
+/* Segment cleaner.  Woken through cleaner_sema; cleaner_busy
+   while it is moving a segment, which may release file_lock, and
+   cleaner_idle, under file_lock, signaled when it stops. */
+static struct semaphore cleaner_sema;
+static bool cleaner_started;         /* Thread created? */
+static bool cleaner_wanted;          /* cleaner_sema already up? */
+static bool cleaner_busy;
+static bool cleaner_stop;            /* Free map closed? */
+static struct condition cleaner_idle;
+static struct bitmap *stuck;         /* Segments given up on this pass. */
+
+static thread_func cleaner_thread NO_RETURN;
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
@@ -19,6 +188,421 @@ free_map_init (void)
     PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  bitmap_mark (free_map, SUPER_SECTOR);
+  bitmap_mark (free_map, REFCOUNT_SECTOR);
+  sema_init (&cleaner_sema, 0);
+  cond_init (&cleaner_idle);
+}
+
+/* Returns true if the file system uses the log-structured
+   layout. */
+bool
+free_map_log_mode (void)
+{
+  return super.log != 0;
+}
+
+/* Records that the CNT bits of free_map starting at SECTOR have
+   changed. */
+static void
+map_touch (disk_sector_t sector, size_t cnt)
+{
+  if (map_dirty == false || sector < map_lo) map_lo = sector;
+  if (map_dirty == false || sector + cnt - 1 > map_hi) map_hi = sector + cnt - 1;
+  map_dirty = true;
+}
+
+/* Writes the changed part of free_map to its file.  Returns
+   false if the write fails. */
+static bool
+map_write (void)
+{
+  bool success = true;
+
+  if (map_dirty == true && free_map_file != NULL)
+    success = bitmap_write_range (free_map, free_map_file, map_lo,
+                                  map_hi - map_lo + 1);
+  map_dirty = false;
+  return success;
+}
+
+/* Returns how many free map sectors map_write() would write if
+   SECTOR's bit changed too. */
+static size_t
+map_span (disk_sector_t sector)
+{
+  size_t lo = map_dirty && map_lo < sector ? map_lo : sector;
+  size_t hi = map_dirty && map_hi > sector ? map_hi : sector;
+
+  return hi / MAP_SECTOR_BITS - lo / MAP_SECTOR_BITS + 1;
+}
+
+/* Returns the first sector of log segment SEG. */
+static disk_sector_t
+seg_start (size_t seg)
+{
+  return super.log_start + seg * SEGMENT_SECTORS;
+}
+
+/* Records that the CNT sectors starting at SECTOR were just
+   allocated in log mode. */
+static void
+mark_fresh (disk_sector_t sector, size_t cnt)
+{
+  if (fresh_map == NULL)
+    return;
+  bitmap_set_multiple (fresh_map, sector, cnt, true);
+  if (fresh_any == false || sector < fresh_lo) fresh_lo = sector;
+  if (fresh_any == false || sector + cnt - 1 > fresh_hi) fresh_hi = sector + cnt - 1;
+  fresh_any = true;
+}
+
+/* Returns true if SECTOR was allocated in log mode since the
+   last commit, so nothing committed refers to it yet. */
+bool
+free_map_fresh (disk_sector_t sector)
+{
+  return fresh_map != NULL && bitmap_test (fresh_map, sector);
+}
+
+/* Writes back the sectors allocated in log mode since the last
+   commit, in ascending runs, and starts a new set.  Called by the
+   journal at the start of every commit, since the metadata it
+   commits may point at them. */
+void
+free_map_sync_log (void)
+{
+  disk_sector_t batch[SEGMENT_SECTORS];
+  size_t cnt = 0;
+  disk_sector_t sector;
+
+  if (fresh_any == false)
+    return;
+
+  for (sector = fresh_lo; sector <= fresh_hi; sector++)
+  {
+    if (bitmap_test (fresh_map, sector) == false) continue;
+    batch[cnt++] = sector;
+    if (cnt == SEGMENT_SECTORS)
+    {
+      disk_sync (filesys_disk, batch, cnt);
+      cnt = 0;
+    }
+  }
+  if (cnt > 0) disk_sync (filesys_disk, batch, cnt);
+
+  bitmap_set_multiple (fresh_map, fresh_lo, fresh_hi - fresh_lo + 1, false);
+  fresh_any = false;
+}
+
+/* Logs the superblock, which records the log head. */
+static void
+checkpoint (void)
+{
+  journal_write (SUPER_SECTOR, &super);
+}
+
+/* Returns the number of clean segments. */
+static size_t
+clean_count (void)
+{
+  size_t cnt = 0;
+  size_t seg;
+
+  for (seg = 0; seg < seg_cnt; seg++)
+    if (bitmap_none (free_map, seg_start (seg), SEGMENT_SECTORS))
+      cnt++;
+  return cnt;
+}
+
+/* Wakes the cleaner thread, if it is not already awake. */
+static void
+wake_cleaner (void)
+{
+  if (cleaner_started == true && cleaner_wanted == false
+      && cleaner_busy == false)
+  {
+    cleaner_wanted = true;
+    sema_up (&cleaner_sema);
+  }
+}
+
+/* Moves the log head to the first clean segment after the one it
+   was filling, writes the segment's empty summary, and logs a
+   checkpoint.  Returns false if no segment is clean. */
+static bool
+open_segment (void)
+{
+  size_t first, i;
+
+  if (cur_seg != NO_SEGMENT)
+    first = cur_seg + 1;
+  else
+    first = (super.log_head - super.log_start) / SEGMENT_SECTORS;
+
+  for (i = 0; i < seg_cnt; i++)
+  {
+    size_t seg = (first + i) % seg_cnt;
+    disk_sector_t start = seg_start (seg);
+
+    if (seg == victim || !bitmap_none (free_map, start, SEGMENT_SECTORS))
+      continue;
+
+    bitmap_mark (free_map, start);
+    map_touch (start, 1);
+    memset (&summary, 0, sizeof summary);
+    disk_write (filesys_disk, start, &summary);
+    mark_fresh (start, 1);
+
+    cur_seg = seg;
+    super.log_head = start + 1;
+    checkpoint ();
+
+    if (clean_count () < CLEAN_LOW)
+      wake_cleaner ();
+    return true;
+  }
+
+  cur_seg = NO_SEGMENT;
+  wake_cleaner ();
+  return false;
+}
+
+/* Returns the first of CNT consecutive free sectors in the log at
+   or after FROM, skipping the segment being cleaned, or
+   BITMAP_ERROR if there are none. */
+static disk_sector_t
+hole_scan (disk_sector_t from, size_t cnt)
+{
+  for (;;)
+  {
+    disk_sector_t sector = bitmap_scan (free_map, from, cnt, false);
+
+    if (sector == BITMAP_ERROR || sector + cnt > log_end)
+      return BITMAP_ERROR;
+    if (victim == NO_SEGMENT || sector + cnt <= seg_start (victim)
+        || sector >= seg_start (victim) + SEGMENT_SECTORS)
+      return sector;
+    from = seg_start (victim) + SEGMENT_SECTORS;
+  }
+}
+
+/* Finds CNT consecutive free sectors at the log head, marks them
+   used, and returns the first, or BITMAP_ERROR if there are
+   none.  A run never spans two segments. */
+static disk_sector_t
+log_scan (size_t cnt)
+{
+  disk_sector_t sector;
+
+  if (cnt >= SEGMENT_SECTORS)
+    return BITMAP_ERROR;
+
+  do
+    if (cur_seg != NO_SEGMENT)
+    {
+      sector = bitmap_scan (free_map, super.log_head, cnt, false);
+      if (sector != BITMAP_ERROR
+          && sector + cnt <= seg_start (cur_seg) + SEGMENT_SECTORS)
+      {
+        bitmap_set_multiple (free_map, sector, cnt, true);
+        mark_fresh (sector, cnt);
+        super.log_head = sector + cnt;
+        return sector;
+      }
+    }
+  while (open_segment ());
+
+  /* No segment is clean, so take whatever is free. */
+  sector = hole_scan (hole_next, cnt);
+  if (sector == BITMAP_ERROR)
+    sector = hole_scan (super.log_start, cnt);
+  if (sector != BITMAP_ERROR)
+  {
+    bitmap_set_multiple (free_map, sector, cnt, true);
+    mark_fresh (sector, cnt);
+    hole_next = sector + cnt;
+  }
+  return sector;
+}
+
+/* Finds CNT consecutive free sectors, marks them used, and
+   returns the first, or BITMAP_ERROR if there are none.  Until
+   the log is set up at format time, log mode allocates like the
+   ordinary layout. */
+static disk_sector_t
+scan (size_t cnt)
+{
+  if (seg_cnt == 0)
+    return bitmap_scan_and_flip (free_map, 0, cnt, false);
+  return log_scan (cnt);
+}
+
+/* Records in its segment's summary that SECTOR, allocated in log
+   mode, now holds BLOCK of inode number INUMBER. */
+void
+free_map_set_owner (disk_sector_t sector, disk_sector_t inumber,
+                    unsigned block)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  if (seg_cnt > 0 && sector >= super.log_start && sector < log_end)
+  {
+    size_t seg = (sector - super.log_start) / SEGMENT_SECTORS;
+    disk_sector_t start = seg_start (seg);
+    struct summary_entry *e = &summary.entries[sector - start];
+
+    ASSERT (sizeof summary == DISK_SECTOR_SIZE);
+
+    disk_read (filesys_disk, start, &summary);
+    e->inumber = inumber;
+    e->block = block;
+    disk_write (filesys_disk, start, &summary);
+    mark_fresh (start, 1);
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Returns true if SECTOR is the inode of a file this module
+   keeps: the free map, the reference counts or the inode map. */
+bool
+free_map_reserved (disk_sector_t sector)
+{
+  return (sector == FREE_MAP_SECTOR || sector == REFCOUNT_SECTOR
+          || (super.imap != 0 && sector == super.imap));
+}
+
+/* Writes inode map entry SLOT to the inode map file. */
+static void
+imap_write (size_t slot)
+{
+  file_write_at (imap_file, &imap[slot], sizeof *imap,
+                 slot * sizeof *imap);
+}
+
+/* Allocates an inode number and stores it into *INUMBERP: in
+   log mode a free inode map entry, whose inode has no sector
+   until free_map_move_inode() gives it one, otherwise a sector
+   for the inode.  Returns true if successful, false if none is
+   free. */
+bool
+free_map_allocate_inode (disk_sector_t *inumberp)
+{
+  if (imap == NULL)
+    return free_map_allocate (1, inumberp);
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t slot;
+
+  for (slot = imap_hint; slot < imap_cnt; slot++)
+    if (imap[slot] == 0)
+      break;
+  if (slot < imap_cnt)
+  {
+    imap[slot] = IMAP_RESERVED;
+    imap_hint = slot + 1;
+    *inumberp = disk_size (filesys_disk) + slot;
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return slot < imap_cnt;
+}
+
+/* Releases inode number INUMBER, from free_map_allocate_inode(),
+   along with the sector its inode is in. */
+void
+free_map_release_inode (disk_sector_t inumber)
+{
+  if (imap == NULL || inumber < disk_size (filesys_disk))
+  {
+    free_map_release (inumber, 1);
+    return;
+  }
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t slot = inumber - disk_size (filesys_disk);
+  disk_sector_t old = imap[slot];
+
+  ASSERT (slot < imap_cnt && old != 0);
+
+  imap[slot] = 0;
+  if (slot < imap_hint)
+    imap_hint = slot;
+  if (old != IMAP_RESERVED)
+  {
+    journal_begin ();
+    imap_write (slot);
+    journal_release (&old, 1);
+    journal_end ();
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Returns the sector that holds the inode of inode number
+   INUMBER, or 0 if it has none. */
+disk_sector_t
+free_map_inode_sector (disk_sector_t inumber)
+{
+  size_t slot;
+
+  if (imap == NULL || inumber < disk_size (filesys_disk))
+    return inumber;
+
+  slot = inumber - disk_size (filesys_disk);
+  if (slot >= imap_cnt || imap[slot] == IMAP_RESERVED)
+    return 0;
+  return imap[slot];
+}
+
+/* Records that the inode of inode number INUMBER, in the inode
+   map, is now at SECTOR.  Its old sector is freed once the
+   change is committed. */
+void
+free_map_move_inode (disk_sector_t inumber, disk_sector_t sector)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t slot = inumber - disk_size (filesys_disk);
+  disk_sector_t old;
+
+  ASSERT (imap != NULL && inumber >= disk_size (filesys_disk)
+          && slot < imap_cnt);
+
+  old = imap[slot];
+  imap[slot] = sector;
+  journal_begin ();
+  imap_write (slot);
+  if (old != 0 && old != IMAP_RESERVED)
+    journal_release (&old, 1);
+  journal_end ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -35,63 +619,531 @@ free_map_allocate (size_t cnt, disk_sector_t *sectorp)
     isLockAcquired = true;
   }
 
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  journal_begin ();
+
+  disk_sector_t sector = scan (cnt);
+
+  /* Space may be waiting to be freed by the reclaim thread.
+     inode_reclaim() also waits out any inode the thread is
+     already freeing. */
+  if (sector == BITMAP_ERROR && inode_reclaim ())
+    sector = scan (cnt);
+
+  if (sector != BITMAP_ERROR)
+  {
+    map_touch (sector, cnt);
+    if (!map_write ())
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
+  }
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
 
+  journal_end ();
+
   if (isLockAcquired == true) lock_release (&file_lock);
 
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Writes refcount_block back to its file if it has changed. */
+static void
+refcount_write (void)
+{
+  if (refcount_dirty == false)
+    return;
+
+  file_write_at (refcount_file, refcount_block, sizeof refcount_block,
+                 refcount_ofs);
+  refcount_dirty = false;
+}
+
+/* Returns a pointer to SECTOR's reference count, reading the
+   block that holds it into refcount_block if necessary.  The
+   pointer is good until the next call. */
+static uint8_t *
+refcount_get (disk_sector_t sector)
+{
+  off_t ofs = sector / DISK_SECTOR_SIZE * DISK_SECTOR_SIZE;
+
+  if (ofs != refcount_ofs)
+  {
+    refcount_write ();
+    refcount_loads++;
+    memset (refcount_block, 0, sizeof refcount_block);
+    file_read_at (refcount_file, refcount_block, sizeof refcount_block, ofs);
+    refcount_ofs = ofs;
+  }
+  return &refcount_block[sector % DISK_SECTOR_SIZE];
+}
+
+/* Drops one owner of in-use SECTOR.  Marks the sector free in
+   the bitmap if that was the last one. */
+static void
+release_one (disk_sector_t sector)
+{
+  ASSERT (bitmap_test (free_map, sector));
+
+  uint8_t *cnt = refcount_file != NULL ? refcount_get (sector) : NULL;
+
+  if (cnt != NULL && *cnt > 0)
+  {
+    (*cnt)--;
+    refcount_dirty = true;
+  }
+  else
+  {
+    bitmap_reset (free_map, sector);
+    map_touch (sector, 1);
+  }
+}
+
+/* Writes out the open transaction of free_map_release_batch() or
+   free_map_share() and opens another if changing SECTOR next
+   could make it write more than SPLIT_SECTORS sectors.  Each
+   sector's release or share stands on its own, so any point
+   between two of them is a consistent place to commit. */
+static void
+split_check (disk_sector_t sector)
+{
+  if (map_span (sector) > SPLIT_SECTORS || refcount_loads >= SPLIT_SECTORS)
+  {
+    map_write ();
+    refcount_write ();
+    journal_end ();
+    journal_begin ();
+    refcount_loads = 0;
+  }
+}
+
+/* Releases CNT sectors starting at SECTOR.  A sector shared by
+   cloned files only loses an owner; the rest become available
+   for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t i;
+
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  journal_begin ();
+  refcount_loads = 0;
+  for (i = 0; i < cnt; i++)
+  {
+    split_check (sector + i);
+    release_one (sector + i);
+  }
+  map_write ();
+  refcount_write ();
+  journal_end ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Returns the segment the cleaner should clean next: the one
+   with the fewest live sectors, at most CLEAN_LIVE_MAX, leaving
+   out clean segments, the one the head is filling and those it
+   gave up on.  Returns NO_SEGMENT if there is none. */
+static size_t
+pick_victim (void)
+{
+  size_t best = NO_SEGMENT;
+  size_t best_live = CLEAN_LIVE_MAX + 1;
+  size_t seg;
+
+  for (seg = 0; seg < seg_cnt; seg++)
+  {
+    disk_sector_t start = seg_start (seg);
+    size_t live;
+
+    if (seg == cur_seg || bitmap_test (stuck, seg)
+        || !bitmap_test (free_map, start))
+      continue;
+    live = bitmap_count (free_map, start, SEGMENT_SECTORS, true) - 1;
+    if (live < best_live)
+    {
+      best = seg;
+      best_live = live;
+    }
+  }
+  return best;
+}
+
+/* Moves the live sectors of segment SEG to the log head and, if
+   that leaves only its summary, frees the segment.  Otherwise
+   marks SEG stuck, so the current pass leaves it alone. */
+static void
+clean_segment (size_t seg)
+{
+  static struct segment_summary victim_summary;
+  disk_sector_t start = seg_start (seg);
+  size_t i;
+
+  victim = seg;
+  disk_read (filesys_disk, start, &victim_summary);
+  for (i = 1; i < SEGMENT_SECTORS; i++)
+  {
+    struct summary_entry *e = &victim_summary.entries[i];
+
+    if (e->inumber != 0 && bitmap_test (free_map, start + i))
+      inode_move_block (e->inumber, e->block, start + i);
+  }
+
+  /* Commit, which frees the sectors just moved. */
+  journal_flush ();
+  if (bitmap_count (free_map, start, SEGMENT_SECTORS, true) == 1)
+    free_map_release (start, 1);
+  else
+    bitmap_mark (stuck, seg);
+  victim = NO_SEGMENT;
+  checkpoint ();
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Segment cleaner thread.  Each time it is woken, cleans
+   segments until CLEAN_HIGH are clean or none is worth
+   cleaning. */
+static void
+cleaner_thread (void *aux UNUSED)
+{
+  for (;;)
+  {
+    sema_down (&cleaner_sema);
+    lock_acquire (&file_lock);
+    cleaner_wanted = false;
+    bitmap_set_all (stuck, false);
+    while (cleaner_stop == false && clean_count () < CLEAN_HIGH)
+    {
+      size_t seg = pick_victim ();
+
+      if (seg == NO_SEGMENT)
+        break;
+      cleaner_busy = true;
+      clean_segment (seg);
+      cleaner_busy = false;
+      cond_broadcast (&cleaner_idle, &file_lock);
+
+      /* Let file system calls in between segments. */
+      lock_release (&file_lock);
+      thread_yield ();
+      lock_acquire (&file_lock);
+    }
+    lock_release (&file_lock);
+  }
+}
+
+/* Adds an owner to each of the CNT in-use sectors listed in
+   SECTORS, for a cloned file.  Returns false, changing nothing,
+   if the disk has no reference counts or a count would
+   overflow. */
+bool
+free_map_share (const disk_sector_t *sectors, size_t cnt)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  bool success = refcount_file != NULL;
+  size_t i;
+
+  for (i = 0; success && i < cnt; i++)
+    if (*refcount_get (sectors[i]) == UINT8_MAX)
+      success = false;
+
+  if (success)
+  {
+    journal_begin ();
+    refcount_loads = 0;
+    for (i = 0; i < cnt; i++)
+    {
+      ASSERT (bitmap_test (free_map, sectors[i]));
+      split_check (sectors[i]);
+      (*refcount_get (sectors[i]))++;
+      refcount_dirty = true;
+    }
+    refcount_write ();
+    journal_end ();
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return success;
+}
+
+/* Returns true if SECTOR belongs to more than one file. */
+bool
+free_map_shared (disk_sector_t sector)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  bool shared = refcount_file != NULL && *refcount_get (sector) > 0;
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return shared;
+}
+
+/* Releases the CNT sectors listed in SECTORS, like
+   free_map_release(), writing the free map to disk once for
+   every few sectors of it the batch touches. */
+void
+free_map_release_batch (const disk_sector_t *sectors, size_t cnt)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t i;
+
+  journal_begin ();
+  refcount_loads = 0;
+  for (i = 0; i < cnt; i++)
+  {
+    split_check (sectors[i]);
+    release_one (sectors[i]);
+  }
+  map_write ();
+  refcount_write ();
+  journal_end ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Stores in SECTORS the sectors recorded by the last
+   free_map_set_warmup() before the file system was shut down,
+   in ascending order, and returns how many there are.  SECTORS
+   must have room for FREE_MAP_WARMUP_MAX entries. */
+size_t
+free_map_warmup (disk_sector_t sectors[])
+{
+  size_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < super.warmup_cnt; i++)
+    if (super.warmup[i] < disk_size (filesys_disk))
+      sectors[cnt++] = super.warmup[i];
+  return cnt;
+}
+
+/* Records the CNT sectors in SECTORS, in ascending order, to be
+   prefetched at the next boot.  Written to disk with the
+   superblock by free_map_close(). */
+void
+free_map_set_warmup (const disk_sector_t sectors[], size_t cnt)
+{
+  ASSERT (cnt <= FREE_MAP_WARMUP_MAX);
+
+  memcpy (super.warmup, sectors, cnt * sizeof *sectors);
+  super.warmup_cnt = cnt;
+}
+
+/* Opens the reference count file. */
+static void
+refcount_open (void)
+{
+  refcount_file = file_open (inode_open (REFCOUNT_SECTOR));
+  if (refcount_file == NULL)
+    PANIC ("can't open reference counts");
+  if (file_length (refcount_file) < (off_t) disk_size (filesys_disk))
+    PANIC ("reference count file is too short");
+  refcount_ofs = -1;
+  refcount_dirty = false;
+}
+
+/* Sets up the log-structured layout described by the
+   superblock: reads the inode map, finds the segment the head
+   was filling and starts the cleaner. */
+static void
+log_open (void)
+{
+  disk_sector_t size = disk_size (filesys_disk);
+  off_t imap_bytes;
+
+  if (super.imap == 0 || super.imap >= super.log_start
+      || super.log_start > size)
+    PANIC ("bad log-structured superblock");
+
+  seg_cnt = (size - super.log_start) / SEGMENT_SECTORS;
+  log_end = seg_start (seg_cnt);
+  hole_next = super.log_start;
+
+  imap_cnt = size / IMAP_RATIO;
+  imap_bytes = imap_cnt * sizeof *imap;
+  if (imap == NULL && (imap = malloc (imap_bytes)) == NULL)
+    PANIC ("inode map allocation failed");
+  imap_file = file_open (inode_open (super.imap));
+  if (imap_file == NULL
+      || file_read_at (imap_file, imap, imap_bytes, 0) != imap_bytes)
+    PANIC ("can't read inode map");
+  imap_hint = 0;
+
+  if (fresh_map == NULL && (fresh_map = bitmap_create (size)) == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  if (seg_cnt > 0 && stuck == NULL
+      && (stuck = bitmap_create (seg_cnt)) == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+
+  /* Resume the segment the head was filling, if it is still
+     allocated. */
+  cur_seg = NO_SEGMENT;
+  if (super.log_head < super.log_start || super.log_head >= log_end)
+    super.log_head = super.log_start;
+  else if ((super.log_head - super.log_start) % SEGMENT_SECTORS != 0)
+  {
+    size_t seg = (super.log_head - super.log_start) / SEGMENT_SECTORS;
+
+    if (bitmap_test (free_map, seg_start (seg)))
+      cur_seg = seg;
+  }
+
+  cleaner_stop = false;
+  if (seg_cnt > 0 && cleaner_started == false)
+  {
+    cleaner_started = true;
+    thread_create ("cleaner", PRI_DEFAULT, cleaner_thread, NULL);
+  }
+}
+
+/* Opens the free map file and reads it from disk, along with
+   the superblock. */
 void
 free_map_open (void) 
 {
+  ASSERT (sizeof super == DISK_SECTOR_SIZE);
+
+  disk_read (filesys_disk, SUPER_SECTOR, &super);
+  if (super.magic != SUPER_MAGIC || super.log_head >= disk_size (filesys_disk))
+    memset (&super, 0, sizeof super);
+  if (super.warmup_cnt > FREE_MAP_WARMUP_MAX)
+    super.warmup_cnt = 0;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+
+  if (super.refcount != 0)
+    refcount_open ();
+  if (super.log != 0)
+    log_open ();
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map to disk and closes the free map file,
+   writing back the superblock with the log head and the warm-up
+   list.  In log mode, first waits for the cleaner to finish the
+   segment it is cleaning, and then closes the inode map. */
 void
 free_map_close (void) 
 {
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  cleaner_stop = true;
+  while (cleaner_busy == true)
+    cond_wait (&cleaner_idle, &file_lock);
+
+  if (super.magic == SUPER_MAGIC)
+    journal_write (SUPER_SECTOR, &super);
+  file_close (imap_file);
+  imap_file = NULL;
   file_close (free_map_file);
+  if (refcount_file != NULL)
+    refcount_write ();
+  file_close (refcount_file);
+  refcount_file = NULL;
+  refcount_ofs = -1;
+
+  if (isLockAcquired == true) lock_release (&file_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it, along with a superblock selecting the log-structured
+   layout if LOG is true and an all-zero reference count file.
+   In log mode also creates the inode map, all free, and starts
+   the log right after it. */
 void
-free_map_create (void) 
+free_map_create (bool log) 
 {
+  struct inode *inode;
+
+  memset (&super, 0, sizeof super);
+  super.magic = SUPER_MAGIC;
+  super.log = log;
+  super.log_head = REFCOUNT_SECTOR + 1;
+  super.refcount = 1;
+
+  /* One byte per sector.  Reserved up front for the same reason
+     as the bitmap below. */
+  if (!inode_create (REFCOUNT_SECTOR, disk_size (filesys_disk), TYPE_FILE, 0)
+      || (inode = inode_open (REFCOUNT_SECTOR)) == NULL
+      || !inode_preallocate (inode, 0, disk_size (filesys_disk)))
+    PANIC ("reference count file creation failed");
+  inode_close (inode);
+
   /* Create inode. */
 
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), TYPE_FILE))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), TYPE_FILE, 0))
     PANIC ("free map creation failed");
 
+  /* Inodes are created sparse, so reserve the bitmap's sectors
+     up front.  Otherwise writing the bitmap would allocate
+     sectors, which would write the bitmap again. */
+  inode = inode_open (FREE_MAP_SECTOR);
+  if (inode == NULL
+      || !inode_preallocate (inode, 0, bitmap_file_size (free_map)))
+    PANIC ("free map preallocation failed");
+
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+
+  /* The inode map, one entry per IMAP_RATIO sectors, and past
+     it the log. */
+  if (log)
+  {
+    off_t imap_bytes = disk_size (filesys_disk) / IMAP_RATIO
+                       * sizeof (disk_sector_t);
+
+    if (!free_map_allocate (1, &super.imap)
+        || !inode_create (super.imap, imap_bytes, TYPE_FILE, 0)
+        || (inode = inode_open (super.imap)) == NULL
+        || !inode_preallocate (inode, 0, imap_bytes))
+      PANIC ("inode map creation failed");
+    inode_close (inode);
+
+    super.log_start = bitmap_scan (free_map, 0, 1, false);
+    if (super.log_start == BITMAP_ERROR)
+      PANIC ("no room for the log");
+    super.log_head = super.log_start;
+  }
+  journal_write (SUPER_SECTOR, &super);
+
+  if (log)
+    log_open ();
 }
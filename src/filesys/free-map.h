@@ -4,14 +4,39 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/disk.h"
+#include "filesys/journal.h"
+
+/* Superblock sector, right after the journal. */
+#define SUPER_SECTOR (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+/* Reference count file inode sector. */
+#define REFCOUNT_SECTOR (SUPER_SECTOR + 1)
+
+/* Most sectors recorded for warming up the cache at boot.  No
+   more than the buffer cache holds. */
+#define FREE_MAP_WARMUP_MAX 64
 
 void free_map_init (void);
 void free_map_read (void);
-void free_map_create (void);
+void free_map_create (bool log);
 void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
 void free_map_release (disk_sector_t, size_t);
+void free_map_release_batch (const disk_sector_t *, size_t);
+bool free_map_log_mode (void);
+bool free_map_fresh (disk_sector_t);
+void free_map_set_owner (disk_sector_t, disk_sector_t inumber, unsigned block);
+void free_map_sync_log (void);
+bool free_map_allocate_inode (disk_sector_t *);
+void free_map_release_inode (disk_sector_t);
+disk_sector_t free_map_inode_sector (disk_sector_t);
+void free_map_move_inode (disk_sector_t, disk_sector_t);
+bool free_map_reserved (disk_sector_t);
+bool free_map_share (const disk_sector_t *, size_t);
+bool free_map_shared (disk_sector_t);
+size_t free_map_warmup (disk_sector_t[]);
+void free_map_set_warmup (const disk_sector_t[], size_t);
 
 #endif /* filesys/free-map.h */
@@ -1,16 +1,23 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "devices/disk.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
+/* Current position on the scratch disk for fsutil_put() and
+   fsutil_extract(). */
+static disk_sector_t put_sector = 0;
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) 
@@ -82,12 +89,13 @@ fsutil_rm (char **argv)
 
    The first call to this function will read starting at the
    beginning of the scratch disk.  Later calls advance across the
-   disk.  This disk position is independent of that used for
-   fsutil_get(), so all `put's should precede all `get's. */
+   disk.  This disk position is shared with fsutil_extract() but
+   independent of that used for fsutil_get(), so all `put's
+   should precede all `get's. */
 void
 fsutil_put (char **argv) 
 {
-  static disk_sector_t sector = 0;
+  disk_sector_t sector = put_sector;
 
   const char *file_name = argv[1];
   struct disk *src;
@@ -117,7 +125,7 @@ fsutil_put (char **argv)
     PANIC ("%s: invalid file size %d", file_name, size);
   
   /* Create destination file. */
-  if (!filesys_create (file_name, size))
+  if (!filesys_create (file_name, size, 0))
     PANIC ("%s: create failed", file_name);
   dst = filesys_open (file_name, &temp);
   if (dst == NULL)
@@ -139,6 +147,7 @@ fsutil_put (char **argv)
   /* Finish up. */
   file_close (dst);
   free (buffer);
+  put_sector = sector;
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -207,3 +216,280 @@ fsutil_get (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Moves file or directory ARGV[1] into one contiguous run of
+   sectors, reporting its extents before and after. */
+void
+fsutil_defrag (char **argv)
+{
+  const char *file_name = argv[1];
+  void *file;
+  struct inode *inode;
+  size_t before;
+  bool is_dir;
+
+  printf ("Defragmenting '%s'...\n", file_name);
+  file = filesys_open (file_name, &is_dir);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  inode = is_dir ? dir_get_inode (file) : file_get_inode (file);
+
+  before = inode_extents (inode);
+  if (!inode_defrag (inode))
+    printf ("%s: not defragmented: metadata, or not enough contiguous "
+            "free space\n", file_name);
+  printf ("%s: %zu extent(s) before, %zu after\n",
+          file_name, before, inode_extents (inode));
+
+  if (is_dir)
+    dir_close (file);
+  else
+    file_close (file);
+}
+
+/* Pages of scratch disk read at a time by fsutil_extract(). */
+#define EXTRACT_PAGES 16
+#define EXTRACT_SECTORS (EXTRACT_PAGES * PGSIZE / DISK_SECTOR_SIZE)
+
+/* Buffered sequential reader over the archive on the scratch
+   disk.  Each ustar block is exactly one disk sector. */
+struct archive
+  {
+    struct disk *disk;          /* Scratch disk. */
+    disk_sector_t next;         /* Next sector to read from disk. */
+    disk_sector_t end;          /* One past the archive's last sector. */
+    uint8_t *buffer;            /* EXTRACT_SECTORS sectors. */
+    size_t pos;                 /* Next unconsumed block in BUFFER. */
+    size_t cnt;                 /* Blocks held in BUFFER. */
+  };
+
+/* Returns up to MAX consecutive blocks of archive A and stores
+   their number in *CNT, refilling A's buffer from disk with a
+   single multi-sector read when it runs dry.  Returns a null
+   pointer at the end of the archive. */
+static const uint8_t *
+archive_blocks (struct archive *a, size_t max, size_t *cnt)
+{
+  const uint8_t *blocks;
+
+  if (a->pos == a->cnt)
+    {
+      size_t n = a->end - a->next;
+      if (n == 0)
+        return NULL;
+      if (n > EXTRACT_SECTORS)
+        n = EXTRACT_SECTORS;
+      disk_read_multi (a->disk, a->next, n, a->buffer);
+      a->next += n;
+      a->pos = 0;
+      a->cnt = n;
+    }
+
+  blocks = a->buffer + a->pos * DISK_SECTOR_SIZE;
+  *cnt = a->cnt - a->pos < max ? a->cnt - a->pos : max;
+  a->pos += *cnt;
+  return blocks;
+}
+
+/* Parses the SIZE-byte octal field at S into *VALUE.  The field
+   may be padded with leading spaces and ends at a space, a null
+   byte, or its last byte. */
+static bool
+parse_octal (const char *s, size_t size, unsigned long *value)
+{
+  size_t i = 0;
+
+  while (i < size && s[i] == ' ')
+    i++;
+  *value = 0;
+  for (; i < size && s[i] >= '0' && s[i] <= '7'; i++)
+    {
+      if (*value > (unsigned long) INT32_MAX >> 3)
+        return false;
+      *value = (*value << 3) | (s[i] - '0');
+    }
+  return i == size || s[i] == ' ' || s[i] == '\0';
+}
+
+/* Returns true if the ustar header in BLOCK carries the "ustar"
+   magic and a correct checksum. */
+static bool
+header_ok (const uint8_t *block)
+{
+  unsigned long chksum;
+  unsigned sum = 0;
+  size_t i;
+
+  if (memcmp (block + 257, "ustar", 5)
+      || !parse_octal ((const char *) block + 148, 8, &chksum))
+    return false;
+
+  /* The checksum field counts as spaces. */
+  for (i = 0; i < DISK_SECTOR_SIZE; i++)
+    sum += i >= 148 && i < 156 ? ' ' : block[i];
+  return sum == chksum;
+}
+
+/* Creates each missing directory leading up to the last
+   component of PATH. */
+static void
+make_parents (char *path)
+{
+  char *p;
+
+  for (p = strchr (path + 1, '/'); p != NULL; p = strchr (p + 1, '/'))
+    {
+      *p = '\0';
+      filesys_mkdir (path);
+      *p = '/';
+    }
+}
+
+/* Extracts the ustar archive on the scratch disk into the file
+   system in a single pass, creating directories and files as
+   their headers are read.
+
+   The archive starts at the current scratch disk position, the
+   same one fsutil_put() uses.  If that sector holds a "PUT\0"
+   header like the one fsutil_put() expects, the archive is the
+   data that follows it; otherwise the archive itself starts
+   there and extends to the first end-of-archive block.  The disk
+   is read EXTRACT_SECTORS sectors at a time, bypassing the
+   buffer cache, and file data goes straight from that buffer to
+   file_write() in runs as long as the buffer allows. */
+void
+fsutil_extract (char **argv UNUSED)
+{
+  struct archive a;
+  const uint8_t *block;
+  size_t file_cnt = 0, dir_cnt = 0;
+  bool framed = false;
+  size_t cnt;
+  char path[155 + 1 + 100 + 1];
+
+  printf ("Extracting archive from scratch disk...\n");
+
+  a.disk = disk_get (1, 0);
+  if (a.disk == NULL)
+    PANIC ("couldn't open source disk (hdc or hd1:0)");
+  a.buffer = palloc_get_multiple (PAL_ASSERT, EXTRACT_PAGES);
+  a.next = put_sector;
+  a.end = disk_size (a.disk);
+  a.pos = a.cnt = 0;
+
+  block = archive_blocks (&a, 1, &cnt);
+  if (block != NULL && !memcmp (block, "PUT", 4))
+    {
+      int32_t size = ((const int32_t *) block)[1];
+      disk_sector_t start = put_sector + 1;
+
+      if (size < 0
+          || (disk_sector_t) DIV_ROUND_UP (size, DISK_SECTOR_SIZE)
+             > a.end - start)
+        PANIC ("invalid archive size %d", size);
+      a.next = start;
+      a.end = start + DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
+      a.pos = a.cnt = 0;
+      framed = true;
+      block = archive_blocks (&a, 1, &cnt);
+    }
+
+  for (; block != NULL; block = archive_blocks (&a, 1, &cnt))
+    {
+      const char *prefix = (const char *) block + 345;
+      const char *name = (const char *) block;
+      char type = block[156];
+      unsigned long size;
+      char *p = path;
+      size_t len;
+
+      /* An all-zero block ends the archive. */
+      for (len = 0; len < DISK_SECTOR_SIZE && block[len] == 0; len++)
+        continue;
+      if (len == DISK_SECTOR_SIZE)
+        break;
+
+      if (!header_ok (block)
+          || !parse_octal ((const char *) block + 124, 12, &size))
+        PANIC ("bad ustar header at scratch sector %"PRDSNu,
+               a.next - (a.cnt - a.pos) - 1);
+
+      /* Full name is PREFIX/NAME, neither necessarily terminated. */
+      len = strnlen (prefix, 155);
+      if (len > 0)
+        {
+          memcpy (p, prefix, len);
+          p += len;
+          *p++ = '/';
+        }
+      len = strnlen (name, 100);
+      memcpy (p, name, len);
+      p[len] = '\0';
+
+      p = path;
+      while (p[0] == '.' && p[1] == '/')
+        p += 2;
+      len = strlen (p);
+      while (len > 0 && p[len - 1] == '/')
+        p[--len] = '\0';
+
+      if (type == '5')
+        {
+          if (len > 0)
+            {
+              make_parents (p);
+              if (filesys_mkdir (p))
+                dir_cnt++;
+            }
+          size = 0;
+        }
+      else if (type == '0' || type == '\0')
+        {
+          struct file *dst;
+          unsigned long left = size;
+          bool is_dir;
+
+          make_parents (p);
+          if (!filesys_create (p, size, 0))
+            PANIC ("%s: create failed", p);
+          dst = filesys_open (p, &is_dir);
+          if (dst == NULL || is_dir)
+            PANIC ("%s: open failed", p);
+
+          while (left > 0)
+            {
+              size_t max = DIV_ROUND_UP (left, DISK_SECTOR_SIZE);
+              off_t chunk;
+
+              block = archive_blocks (&a, max, &cnt);
+              if (block == NULL)
+                PANIC ("%s: archive truncated", p);
+              chunk = cnt * DISK_SECTOR_SIZE < left
+                      ? cnt * DISK_SECTOR_SIZE : left;
+              if (file_write (dst, block, chunk) != chunk)
+                PANIC ("%s: write failed with %lu bytes unwritten",
+                       p, left);
+              left -= chunk;
+            }
+          file_close (dst);
+          file_cnt++;
+          continue;
+        }
+      else
+        printf ("%s: skipping entry of type '%c'\n", p, type);
+
+      /* Skip the data of entries not extracted. */
+      for (cnt = DIV_ROUND_UP (size, DISK_SECTOR_SIZE); cnt > 0; )
+        {
+          size_t n;
+          if (archive_blocks (&a, cnt, &n) == NULL)
+            break;
+          cnt -= n;
+        }
+    }
+
+  put_sector = framed ? a.end : a.next - (a.cnt - a.pos);
+  palloc_free_multiple (a.buffer, EXTRACT_PAGES);
+  printf ("Extracted %zu files and %zu directories.\n",
+          file_cnt, dir_cnt);
+}
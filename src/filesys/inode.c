@@ -2,19 +2,62 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdlib.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/lz.h"
 #include "threads/malloc.h"
 #include "devices/disk.h"
 #include "threads/synch.h"
 #include "userprog/syscall.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 #define PT_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
 
+/* Files up to this many bytes keep their data in the inode. */
+#define INODE_INLINE_MAX 480
+
+/* Data sectors addressed straight from the inode, sharing space
+   with the inline data.  Later sectors go through the two-level
+   index rooted at inode_disk.child. */
+#define DIRECT_CNT (INODE_INLINE_MAX / sizeof (disk_sector_t))
+
+/* Largest number of data sectors an inode can address. */
+#define MAX_SECTORS (DIRECT_CNT + PT_PER_SECTOR * PT_PER_SECTOR)
+
+/* Bounds on an inode's allocation window, in sectors. */
+#define WINDOW_MIN 8
+#define WINDOW_MAX 64
+
+/* inode_disk flags, besides INODE_COMPRESSED in inode.h. */
+#define INODE_INLINE 0x1                /* Data lives in inline_data. */
+
+/* Compressed files are stored as CHUNK_SIZE-byte chunks, each
+   compressed into a run of consecutive sectors.  For chunk C,
+   index entry C * CHUNK_SECTORS holds the first sector of the
+   run (0 if the chunk is a hole) and the next entry holds its
+   compressed size in bytes, CHUNK_SIZE if stored uncompressed.
+   The chunk's other entries are unused. */
+#define CHUNK_SECTORS 8
+#define CHUNK_SIZE (CHUNK_SECTORS * DISK_SECTOR_SIZE)
+
+/* Decompressed chunks kept in memory. */
+#define CHUNK_CACHE_CNT 8
+
+/* Blocks of an inode, as recorded in the segment summaries of
+   the log-structured layout (see free-map.c).  A data sector is
+   its index in the file. */
+#define BLOCK_INODE 0xffffffff          /* The inode itself. */
+#define BLOCK_TOP 0xfffffffe            /* Top-level index block. */
+#define BLOCK_LV1(K) (0x80000000 | (K)) /* Level-1 index block K. */
+
 struct inode_child
 {
   disk_sector_t pt[PT_PER_SECTOR];
@@ -24,11 +67,17 @@ struct inode_child
    Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    disk_sector_t child;
+    disk_sector_t child;                /* Top-level index, 0 if none. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
     int type;                           /* 0: file, 1: directory */
-    int unused[124];
+    unsigned flags;                     /* INODE_* flags. */
+    union
+      {
+        uint8_t inline_data[INODE_INLINE_MAX]; /* Data of small files. */
+        disk_sector_t direct[DIRECT_CNT];      /* First data sectors. */
+      };
+    int unused[3];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -39,14 +88,31 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Data sectors whose writes an in-memory inode remembers for
+   inode_sync(). */
+#define INODE_DIRTY_MAX 32
+
 /* In-memory inode. */
 struct inode 
   {
     struct list_elem elem;              /* Element in inode list. */
-    disk_sector_t sector;               /* Sector number of disk location. */
+    disk_sector_t sector;               /* Inode number: its sector, or an
+                                           inode map number in log mode. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool dirty;                         /* DATA differs from disk copy. */
+    disk_sector_t window;               /* Next sector reserved for data. */
+    size_t window_left;                 /* Sectors left in the window. */
+    size_t window_size;                 /* Size of the next window. */
+    disk_sector_t dirty_sectors[INODE_DIRTY_MAX]; /* Data written since
+                                           the last inode_sync(). */
+    size_t dirty_cnt;                   /* Entries in dirty_sectors[]. */
+    bool dirty_overflow;                /* More written than fit? */
+    struct thread *io_owner;            /* Thread moving data without
+                                           file_lock, or null. */
+    bool io_write;                      /* IO_OWNER is writing? */
+    struct condition io_idle;           /* Signaled when IO_OWNER clears. */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -54,20 +120,77 @@ struct inode
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Removed inodes whose blocks are waiting to be freed, and the
+   semaphore that wakes the reclaim thread for them. */
+static struct list reclaim_list;
+static struct semaphore reclaim_sema;
+
+/* Inodes taken off reclaim_list whose blocks are still being
+   freed, and the condition, under file_lock, signaled when that
+   drops to zero. */
+static struct list reclaim_active;
+static int reclaim_busy;
+static struct condition reclaim_idle;
+
+/* Sectors freed per free map update by the reclaim thread. */
+#define RECLAIM_BATCH (PGSIZE / sizeof (disk_sector_t))
+
+/* A decompressed chunk of a compressed file. */
+struct chunk_entry
+  {
+    struct inode *inode;                /* Owning inode, NULL if free. */
+    size_t chunk;                       /* Chunk number in file. */
+    bool accessed;                      /* Used since the clock passed? */
+    uint8_t *data;                      /* CHUNK_SIZE bytes. */
+  };
+
+/* Decompressed chunk cache, replaced in clock order and
+   protected by file_lock.  Chunks are written through on every
+   change, so entries are never dirty. */
+static struct chunk_entry chunk_cache[CHUNK_CACHE_CNT];
+static size_t chunk_hand;
+
+/* Compressed chunk buffer and codec scratch space. */
+static uint8_t *chunk_packed;
+static void *chunk_work;
+
+static void release_window (struct inode *);
+static void chunk_invalidate (struct inode *);
+static bool is_logged (const struct inode *);
+static bool place_inode (disk_sector_t, const struct inode_disk *);
+static thread_func reclaim_thread NO_RETURN;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  list_init (&reclaim_list);
+  list_init (&reclaim_active);
+  chunk_packed = palloc_get_page (PAL_ASSERT);
+  chunk_work = malloc (LZ_WORK_SIZE);
+  if (chunk_work == NULL)
+    PANIC ("compression scratch allocation failed");
+  sema_init (&reclaim_sema, 0);
+  reclaim_busy = 0;
+  cond_init (&reclaim_idle);
+  thread_create ("reclaim", PRI_DEFAULT, reclaim_thread, NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   disk.
+   disk, or in the log-structured layout gives it to inode number
+   SECTOR from free_map_allocate_inode().  Files of up to INODE_INLINE_MAX bytes keep their data
+   inside the inode sector itself.  For larger files only the
+   inode is allocated; data sectors and index blocks start out
+   as holes, which read as zeros and are filled in by
+   inode_write_at() or inode_preallocate().
+   FLAGS may be INODE_COMPRESSED to store the data compressed.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length, enum file_status type)
+inode_create (disk_sector_t sector, off_t length, enum file_status type,
+              unsigned flags)
 {
   bool isLockAcquired = false;
   if (lock_held_by_current_thread (&file_lock) == false)
@@ -77,11 +200,7 @@ inode_create (disk_sector_t sector, off_t length, enum file_status type)
   }
 
   struct inode_disk *disk_inode = NULL;
-  disk_sector_t child;
-  struct inode_child *ic = palloc_get_page (PAL_ZERO);
-  struct inode_child *ic2 = palloc_get_page (PAL_ZERO);
-  bool success = true;
-  int i, j;
+  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -91,56 +210,34 @@ inode_create (disk_sector_t sector, off_t length, enum file_status type)
 
   disk_inode = calloc (1, sizeof *disk_inode);
 
-  if (disk_inode == NULL) success = false;
-
-  if (free_map_allocate (1, &child) == false) return false;
-  disk_inode->child = child;
-  disk_inode->length = length;
-  disk_inode->magic = INODE_MAGIC;
-  disk_inode->type = type;
-  disk_write (filesys_disk, sector, disk_inode);
-
-  int lv1 = length / PT_PER_SECTOR / DISK_SECTOR_SIZE;
-  int lv2 = (length % (PT_PER_SECTOR * DISK_SECTOR_SIZE)) / DISK_SECTOR_SIZE;
-
-  for (i = 0; i < lv1; i++)
+  if (disk_inode != NULL)
   {
-    if (free_map_allocate (1, &child) == false) return false;
-    ic->pt[i] = child;
-
-    for (j = 0; j < PT_PER_SECTOR; j++)
+    disk_inode->length = length;
+    disk_inode->magic = INODE_MAGIC;
+    disk_inode->type = type;
+    if (flags & INODE_COMPRESSED)
+      disk_inode->flags = INODE_COMPRESSED;
+    else if (length <= INODE_INLINE_MAX)
+      disk_inode->flags = INODE_INLINE;
+
+    if (sector < disk_size (filesys_disk))
     {
-      if (free_map_allocate (1, &child) == false) return false;
-      ic2->pt[j] = child;  
+      journal_write (sector, disk_inode);
+      success = true;
     }
-
-    disk_write (filesys_disk, ic->pt[i], ic2);
-  }
-
-  if (free_map_allocate (1, &child) == false) return false;
-  ic->pt[lv1] = child;
-  
-  for (j = 0; j <= lv2; j++)
-  {
-      if (free_map_allocate (1, &child) == false) return false;
-      ic2->pt[j] = child; 
+    else
+      success = place_inode (sector, disk_inode);
   }
-  for (; j < PT_PER_SECTOR; j++) ic2->pt[j] = NULL;
-
-  disk_write (filesys_disk, ic->pt[lv1], ic2);
-   
-  disk_write (filesys_disk, disk_inode->child, ic);
 
-  palloc_free_page (ic);
-  palloc_free_page (ic2);
+  free (disk_inode);
  
   if (isLockAcquired == true) lock_release (&file_lock);
  
-  // palloc = free_map_allocate
   return success;
 }
 
-/* Reads an inode from SECTOR
+/* Reads an inode from SECTOR, or the sector the inode map gives
+   for inode number SECTOR,
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *
@@ -185,7 +282,15 @@ inode_open (disk_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  disk_read (filesys_disk, inode->sector, &inode->data);
+  inode->dirty = false;
+  inode->window_left = 0;
+  inode->window_size = WINDOW_MIN;
+  inode->dirty_cnt = 0;
+  inode->dirty_overflow = false;
+  inode->io_owner = NULL;
+  inode->io_write = false;
+  cond_init (&inode->io_idle);
+  disk_read (filesys_disk, free_map_inode_sector (inode->sector), &inode->data);
 
   if (isLockAcquired == true) lock_release (&file_lock);
 
@@ -251,53 +356,84 @@ inode_close (struct inode *inode)
     {
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
+      chunk_invalidate (inode);
+
+      if (inode->removed == false) inode_flush (inode);
+      release_window (inode);
  
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      /* Deallocate blocks if removed.  Freeing a large file
+         takes thousands of free map updates, so the blocks are
+         handed to the reclaim thread instead of making the
+         closing process (often in exit) wait for them. */
+      if (inode->removed)
         {
-          int length = inode->data.length;
-          int lv1 = length / PT_PER_SECTOR / DISK_SECTOR_SIZE;
-          int lv2 = (length % (PT_PER_SECTOR * DISK_SECTOR_SIZE)) / DISK_SECTOR_SIZE;
-          int i, j;
-          struct inode_child *ic = palloc_get_page (PAL_ZERO);
-          struct inode_child *ic2 = palloc_get_page (PAL_ZERO);
+          list_push_back (&reclaim_list, &inode->elem);
+          sema_up (&reclaim_sema);
+        }
+      else
+        free (inode); 
+    }
+  
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
 
-          disk_read (filesys_disk, inode->data.child, ic);
-          free_map_release (inode->data.child, 1);
+/* Returns true if a thread other than the current one owns
+   INODE's data through inode_io_begin() in a way that conflicts
+   with the caller: any owner if WRITE is true, otherwise only one
+   that is writing. */
+static bool
+io_busy (const struct inode *inode, bool write)
+{
+  return (inode->io_owner != NULL && inode->io_owner != thread_current ()
+          && (write || inode->io_write));
+}
 
-          for (i = 0; i < lv1; i++)
-          {
-            disk_read (filesys_disk, ic->pt[i], ic2);
-            free_map_release (ic->pt[i], 1);
+/* Waits until no other thread owns INODE's data through
+   inode_io_begin() in a way that conflicts with reading it or, if
+   WRITE is true, changing it.  Everything that touches the data,
+   size or index of an inode calls this first. */
+static void
+io_wait (struct inode *inode, bool write)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
 
-            for (j = 0; j < PT_PER_SECTOR; j++)
-            {
-              free_map_release (ic2->pt[j], 1);
-            }
-          }
+  while (io_busy (inode, write))
+    cond_wait (&inode->io_idle, &file_lock);
 
-          disk_read (filesys_disk, ic->pt[lv1], ic2);
-          free_map_release (ic->pt[lv1], 1);
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
 
-          for (j = 0; j <= lv2; j++)
-          {
-            free_map_release (ic2->pt[j], 1);
-          }
+/* Makes the current thread the owner of INODE's data, so that it
+   may read INODE or, if WRITE is true, write it without holding
+   file_lock.  Until inode_io_end(), other threads wait in
+   io_wait() before changing INODE, and before reading it too if
+   WRITE is true.  The free map, journal and buffer cache keep
+   their own locking, so only other users of INODE wait. */
+void
+inode_io_begin (struct inode *inode, bool write)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  io_wait (inode, true);
+  inode->io_owner = thread_current ();
+  inode->io_write = write;
 
-          palloc_free_page (ic);
-          palloc_free_page (ic2);
-        }
-      
-      free (inode); 
-    }
-  
   if (isLockAcquired == true) lock_release (&file_lock);
 }
 
-/* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+/* Gives up the ownership taken by inode_io_begin(). */
 void
-inode_remove (struct inode *inode) 
+inode_io_end (struct inode *inode)
 {
   bool isLockAcquired = false;
   if (lock_held_by_current_thread (&file_lock) == false)
@@ -306,190 +442,1313 @@ inode_remove (struct inode *inode)
     isLockAcquired = true;
   }
 
-  ASSERT (inode != NULL);
-  inode->removed = true;
+  ASSERT (inode->io_owner == thread_current ());
+  inode->io_owner = NULL;
+  cond_broadcast (&inode->io_idle, &file_lock);
 
   if (isLockAcquired == true) lock_release (&file_lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Gives INODE's unused allocation window back to the free map. */
+static void
+release_window (struct inode *inode)
+{
+  if (inode->window_left > 0)
+  {
+    free_map_release (inode->window, inode->window_left);
+    inode->window_left = 0;
+  }
+}
+
+/* Writes DISK_INODE, the inode of inode number INUMBER from the
+   inode map, to a newly allocated sector at the log head and
+   points the inode map at it.  Returns false if INUMBER is a
+   fixed sector or the disk is full. */
+static bool
+place_inode (disk_sector_t inumber, const struct inode_disk *disk_inode)
+{
+  disk_sector_t sector;
+
+  if (inumber < disk_size (filesys_disk)
+      || free_map_allocate (1, &sector) == false)
+    return false;
+  free_map_set_owner (sector, inumber, BLOCK_INODE);
+
+  journal_begin ();
+  if (disk_inode->type == TYPE_DIRECTORY)
+    journal_write (sector, disk_inode);
+  else
+    disk_write (filesys_disk, sector, disk_inode);
+  free_map_move_inode (inumber, sector);
+  journal_end ();
+
+  return true;
+}
+
+/* Writes INODE's in-memory copy back to its sector if it has
+   changed.  Length and block pointer updates only mark the inode
+   dirty, so a run of small writes costs one inode write here
+   instead of one per call.  In log mode a file's inode moves to
+   the log head the first time it is written after a commit, and
+   is rewritten there in place until the next one. */
+void
+inode_flush (struct inode *inode)
+{
+  if (inode != NULL && inode->dirty)
+  {
+    disk_sector_t sector = free_map_inode_sector (inode->sector);
+
+    if (is_logged (inode) && free_map_fresh (sector))
+      disk_write (filesys_disk, sector, &inode->data);
+    else if (is_logged (inode) == false
+             || place_inode (inode->sector, &inode->data) == false)
+      journal_write (sector, &inode->data);
+    inode->dirty = false;
+  }
+}
+
+/* Writes back every open inode that has unwritten changes. */
+void
+inode_flush_all (void)
 {
-/*   bool isLockAcquired = false;
+  bool isLockAcquired = false;
   if (lock_held_by_current_thread (&file_lock) == false)
   {
     lock_acquire (&file_lock);
     isLockAcquired = true;
-  } */
+  }
 
-  uint8_t *buffer = buffer_;
-  off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
-  struct inode_child *tmp1 = palloc_get_page (PAL_ZERO);
-  struct inode_child *tmp2 = palloc_get_page (PAL_ZERO);
-  bool zero_sector;
+  struct list_elem *e;
 
-  while (size > 0) 
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+  {
+    struct inode *inode = list_entry (e, struct inode, elem);
+
+    io_wait (inode, false);
+    inode_flush (inode);
+    release_window (inode);
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* A list of sectors. */
+struct sector_list
+  {
+    disk_sector_t *sectors;             /* Sectors. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+
+/* Called for each sector by walk_sectors(). */
+typedef void sector_func (disk_sector_t sector, void *aux);
+
+/* Calls FUNC (SECTOR, AUX) for each data sector named by ENTRY,
+   index entry IDX of INODE.  In a compressed file the first
+   entry of a chunk, remembered in *RUN, and the second, its
+   size, together name a run of sectors. */
+static void
+entry_sectors (const struct inode *inode, size_t idx, disk_sector_t entry,
+               disk_sector_t *run, sector_func *func, void *aux)
+{
+  size_t i;
+
+  if ((inode->data.flags & INODE_COMPRESSED) == 0)
+  {
+    if (entry != 0) func (entry, aux);
+  }
+  else if (idx % CHUNK_SECTORS == 0)
+    *run = entry;
+  else if (idx % CHUNK_SECTORS == 1 && *run != 0)
+  {
+    for (i = 0; i < bytes_to_sectors (entry); i++)
+      func (*run + i, aux);
+  }
+}
+
+/* Calls FUNC (SECTOR, AUX) for every data sector of INODE, and
+   for its index blocks as well if WITH_INDEX is true.  Holes are
+   stored as zero and skipped. */
+static void
+walk_sectors (const struct inode *inode, bool with_index,
+              sector_func *func, void *aux)
+{
+  disk_sector_t run = 0;
+  size_t i, j;
+
+  if (inode->data.flags & INODE_INLINE)
+    return;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    entry_sectors (inode, i, inode->data.direct[i], &run, func, aux);
+
+  if (inode->data.child != 0)
+  {
+    struct inode_child *ic = palloc_get_page (PAL_ASSERT);
+    struct inode_child *ic2 = palloc_get_page (PAL_ASSERT);
+
+    disk_read (filesys_disk, inode->data.child, ic);
+    if (with_index) func (inode->data.child, aux);
+
+    for (i = 0; i < PT_PER_SECTOR; i++)
     {
-      if (inode_length (inode) < offset) break;
+      if (ic->pt[i] == 0) continue;
 
-      int lv1 = offset / PT_PER_SECTOR / DISK_SECTOR_SIZE;
-      int lv2 = (offset % (PT_PER_SECTOR * DISK_SECTOR_SIZE)) / DISK_SECTOR_SIZE;
-      disk_sector_t sector_idx;
+      disk_read (filesys_disk, ic->pt[i], ic2);
+      if (with_index) func (ic->pt[i], aux);
 
-      zero_sector = false;
+      for (j = 0; j < PT_PER_SECTOR; j++)
+        entry_sectors (inode, DIRECT_CNT + i * PT_PER_SECTOR + j,
+                       ic2->pt[j], &run, func, aux);
+    }
 
-      disk_read (filesys_disk, inode->data.child, tmp1);
-    
-      if (tmp1->pt[lv1] == NULL) zero_sector = true;
-      else
-      {
-        disk_read (filesys_disk, tmp1->pt[lv1], tmp2);
-        sector_idx = tmp2->pt[lv2];
-        if (sector_idx == NULL) zero_sector = true;
-      }
+    palloc_free_page (ic);
+    palloc_free_page (ic2);
+  }
+}
 
-      /* Disk sector to read, starting byte offset within sector. */
-//      disk_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
+/* Adds SECTOR to the sector_list BATCH, handing the batch to the
+   free map once it is full. */
+static void
+batch_add (disk_sector_t sector, void *batch_)
+{
+  struct sector_list *batch = batch_;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+  batch->sectors[batch->cnt++] = sector;
+  if (batch->cnt == RECLAIM_BATCH)
+  {
+    free_map_release_batch (batch->sectors, batch->cnt);
+    batch->cnt = 0;
+  }
+}
 
-      /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+/* Frees the inode sector, index blocks and data sectors of
+   removed INODE, whose last opener has closed it.  Sectors
+   shared with a clone only lose an owner. */
+static void
+reclaim_blocks (struct inode *inode)
+{
+  struct sector_list batch;
 
-      if (zero_sector == true)
-      {
-        memset (buffer + bytes_read, 0, chunk_size);
-      }
+  batch.sectors = palloc_get_page (PAL_ASSERT);
+  batch.cnt = 0;
 
-      else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
-      {
-        /* Read full sector directly into caller's buffer. */
-        disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-      }
+  if (inode->sector < disk_size (filesys_disk))
+    batch_add (inode->sector, &batch);
+  else
+    free_map_release_inode (inode->sector);
+  walk_sectors (inode, true, batch_add, &batch);
 
-      else 
-      {
-        /* Read sector into bounce buffer, then partially copy
-           into caller's buffer. */
-        if (bounce == NULL) 
-        {
-          bounce = malloc (DISK_SECTOR_SIZE);
-          if (bounce == NULL)
-            break;
-        }
-        disk_read (filesys_disk, sector_idx, bounce);
-        memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-      }
+  if (batch.cnt > 0) free_map_release_batch (batch.sectors, batch.cnt);
+  palloc_free_page (batch.sectors);
+}
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_read += chunk_size;
+/* Frees the blocks of every removed inode queued so far, and
+   waits for those another thread is already freeing, so that on
+   return every removed inode's blocks are back in the free map.
+   Waiting releases file_lock if the caller holds it.  Returns
+   true if any blocks were freed. */
+bool
+inode_reclaim (void)
+{
+  bool reclaimed = false;
+
+  for (;;)
+  {
+    struct inode *inode = NULL;
+
+    bool isLockAcquired = false;
+    if (lock_held_by_current_thread (&file_lock) == false)
+    {
+      lock_acquire (&file_lock);
+      isLockAcquired = true;
+    }
+
+    while (list_empty (&reclaim_list) && reclaim_busy > 0)
+    {
+      cond_wait (&reclaim_idle, &file_lock);
+      reclaimed = true;
+    }
+
+    if (list_empty (&reclaim_list) == false)
+    {
+      inode = list_entry (list_pop_front (&reclaim_list), struct inode, elem);
+      list_push_back (&reclaim_active, &inode->elem);
+      reclaim_busy++;
     }
-  free (bounce);
 
-  palloc_free_page (tmp1);
-  palloc_free_page (tmp2);
+    if (isLockAcquired == true) lock_release (&file_lock);
 
-//  if (isLockAcquired == true) lock_release (&file_lock);
+    if (inode == NULL) break;
 
-  return bytes_read;
+    reclaim_blocks (inode);
+    reclaimed = true;
+
+    isLockAcquired = false;
+    if (lock_held_by_current_thread (&file_lock) == false)
+    {
+      lock_acquire (&file_lock);
+      isLockAcquired = true;
+    }
+
+    list_remove (&inode->elem);
+    free (inode);
+    if (--reclaim_busy == 0)
+      cond_broadcast (&reclaim_idle, &file_lock);
+
+    if (isLockAcquired == true) lock_release (&file_lock);
+  }
+
+  return reclaimed;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Background thread that frees the blocks of removed inodes. */
+static void
+reclaim_thread (void *aux UNUSED)
 {
-//  printf ("write at %x size%d\n", inode, size);
+  for (;;)
+  {
+    sema_down (&reclaim_sema);
+    inode_reclaim ();
+  }
+}
 
-/*  bool isLockAcquired = false;
+/* Marks INODE to be deleted when it is closed by the last caller who
+   has it open. */
+void
+inode_remove (struct inode *inode) 
+{
+  bool isLockAcquired = false;
   if (lock_held_by_current_thread (&file_lock) == false)
   {
     lock_acquire (&file_lock);
     isLockAcquired = true;
-  } */
+  }
 
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-  struct inode_child *tmp1 = palloc_get_page(PAL_ZERO);
-  struct inode_child *tmp2 = palloc_get_page(PAL_ZERO);
-  int i;
+  ASSERT (inode != NULL);
+  inode->removed = true;
 
-  if (inode->deny_write_cnt)
-  {
-//    if (isLockAcquired == true) lock_release (&file_lock);
-    return 0;
-  }
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Reads up to SIZE bytes at OFFSET from the data stored inline in
+   INODE into BUFFER.  Returns the number of bytes read. */
+static off_t
+inline_read (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  off_t length = inode_length (inode);
+
+  if (offset >= length) return 0;
+  if (size > length - offset) size = length - offset;
+
+  memcpy (buffer, inode->data.inline_data + offset, size);
+  return size;
+}
 
+/* Writes SIZE bytes from BUFFER at OFFSET into the data stored
+   inline in INODE, which must have room for them.  Bytes past
+   end of file are kept zero, so holes read back as zeros. */
+static off_t
+inline_write (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  ASSERT (offset + size <= INODE_INLINE_MAX);
+
+  memcpy (inode->data.inline_data + offset, buffer, size);
   if (inode_length (inode) < offset + size) inode->data.length = offset + size;
-  disk_write (filesys_disk, inode->sector, &inode->data);
-  
-  while (size > 0) 
-    {
-      int lv1 = offset / PT_PER_SECTOR / DISK_SECTOR_SIZE;
-      int lv2 = (offset % (PT_PER_SECTOR * DISK_SECTOR_SIZE)) / DISK_SECTOR_SIZE;
+  inode->dirty = true;
 
-      disk_read (filesys_disk, inode->data.child, tmp1);
+  return size;
+}
 
-      if (tmp1->pt[lv1] == NULL) 
-      {
-        struct inode_child *ic = palloc_get_page (PAL_ZERO);
-        disk_sector_t child;
-        if (free_map_allocate (1, &child) == false) return false;
+/* Moves the data stored inline in INODE out to ordinary data
+   sectors, so that the file can grow past INODE_INLINE_MAX
+   bytes.  Returns true if successful, false if the disk is
+   full. */
+static bool
+inline_migrate (struct inode *inode)
+{
+  uint8_t *data = malloc (INODE_INLINE_MAX);
+  off_t length = inode_length (inode);
+  bool success = false;
 
-        for (i = 0; i < PT_PER_SECTOR; i++) ic->pt[i] = NULL; 
-        disk_write (filesys_disk, child, ic);  // fill with NULL 
-  
-        tmp1->pt[lv1] = child;
-        disk_write (filesys_disk, inode->data.child, tmp1);
-      }
+  if (data != NULL)
+  {
+    memcpy (data, inode->data.inline_data, length);
 
-      disk_read (filesys_disk, tmp1->pt[lv1], tmp2);
+    /* The inline bytes become the (all-hole) direct pointers. */
+    memset (inode->data.inline_data, 0, INODE_INLINE_MAX);
+    inode->data.flags &= ~INODE_INLINE;
+    inode->data.length = 0;
 
-      if (tmp2->pt[lv2] == NULL)
-      {
-        disk_sector_t child;
-        if (free_map_allocate (1, &child) == false) return false;
-        tmp2->pt[lv2] = child;
-        disk_write (filesys_disk, tmp1->pt[lv1], tmp2);
-      }
+    success = inode_write_at (inode, data, length, 0) == length;
+    inode->data.length = length;
+    inode->dirty = true;
+  }
 
-      disk_sector_t sector_idx = tmp2->pt[lv2];
+  free (data);
 
-      /* Sector to write, starting byte offset within sector. */
-//      disk_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
+  return success;
+}
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+/* Sectors written back per disk_sync() by inode_sync(). */
+#define SYNC_BATCH (PGSIZE / sizeof (disk_sector_t))
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+/* Orders disk sector numbers for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const disk_sector_t *a = a_;
+  const disk_sector_t *b = b_;
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
-        {
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Adds SECTOR to the sector_list BATCH for inode_sync(), writing
+   the batch back once it is full.  A SECTOR of 0 writes back
+   what is left. */
+static void
+sync_add (disk_sector_t sector, void *batch_)
+{
+  struct sector_list *batch = batch_;
+
+  if (sector != 0)
+    batch->sectors[batch->cnt++] = sector;
+  if ((sector == 0 || batch->cnt == SYNC_BATCH) && batch->cnt > 0)
+  {
+    qsort (batch->sectors, batch->cnt, sizeof *batch->sectors,
+           compare_sectors);
+    disk_sync (filesys_disk, batch->sectors, batch->cnt);
+    batch->cnt = 0;
+  }
+}
+
+/* Makes INODE durable: writes its dirty data sectors back from
+   the cache in ascending order, then commits its inode and index
+   blocks, which go through the journal, and writes them home.
+   The data goes first, so the committed metadata never points at
+   stale sectors.  Committing the journal also commits whatever
+   other metadata is logged, since a commit is all or nothing.
+   Returns false if memory runs out. */
+bool
+inode_sync (struct inode *inode)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct sector_list batch;
+  bool success = true;
+
+  io_wait (inode, false);
+  if (inode->dirty_overflow)
+  {
+    /* Too much written to remember: look at every data sector,
+       which walk_sectors() visits mostly in ascending order. */
+    batch.sectors = palloc_get_page (0);
+    batch.cnt = 0;
+    if (batch.sectors == NULL)
+      success = false;
+    else
+    {
+      walk_sectors (inode, false, sync_add, &batch);
+      sync_add (0, &batch);
+      palloc_free_page (batch.sectors);
+    }
+  }
+  else
+  {
+    qsort (inode->dirty_sectors, inode->dirty_cnt,
+           sizeof *inode->dirty_sectors, compare_sectors);
+    disk_sync (filesys_disk, inode->dirty_sectors, inode->dirty_cnt);
+  }
+
+  if (success)
+  {
+    inode->dirty_cnt = 0;
+    inode->dirty_overflow = false;
+  }
+
+  inode_flush (inode);
+  journal_flush ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return success;
+}
+
+/* Returns true if INODE's contents are file system metadata,
+   whose sectors go through the journal: directories and the
+   files the free map keeps. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode->data.type == TYPE_DIRECTORY || free_map_reserved (inode->sector);
+}
+
+/* Returns true if INODE is a file whose data, index blocks and
+   inode move to the log head when rewritten, which is every file
+   but metadata in the log-structured layout. */
+static bool
+is_logged (const struct inode *inode)
+{
+  return free_map_log_mode () && !is_metadata (inode);
+}
+
+/* Remembers that data sector SECTOR of INODE was written into
+   the cache, for inode_sync().  Once more sectors have been
+   written than INODE can remember, inode_sync() looks at all of
+   them instead. */
+static void
+note_dirty (struct inode *inode, disk_sector_t sector)
+{
+  size_t i;
+
+  if (inode->dirty_overflow)
+    return;
+  for (i = 0; i < inode->dirty_cnt; i++)
+    if (inode->dirty_sectors[i] == sector)
+      return;
+  if (inode->dirty_cnt == INODE_DIRTY_MAX)
+    inode->dirty_overflow = true;
+  else
+    inode->dirty_sectors[inode->dirty_cnt++] = sector;
+}
+
+/* Writes data sector SECTOR of INODE from BUFFER, through the
+   journal if INODE holds metadata. */
+static void
+data_write (struct inode *inode, disk_sector_t sector,
+            const void *buffer)
+{
+  if (is_metadata (inode))
+    journal_write (sector, buffer);
+  else
+  {
+    disk_write (filesys_disk, sector, buffer);
+    note_dirty (inode, sector);
+  }
+}
+
+/* Returns the sector that holds data sector IDX of INODE, or 0 if
+   that part of the file is a hole.  Sectors past the direct
+   pointers are looked up through the two-level index, using
+   SCRATCH as a sector-sized buffer. */
+static disk_sector_t
+index_to_sector (const struct inode *inode, size_t idx,
+                 struct inode_child *scratch)
+{
+  ASSERT ((inode->data.flags & INODE_INLINE) == 0);
+
+  if (idx < DIRECT_CNT)
+    return inode->data.direct[idx];
+
+  idx -= DIRECT_CNT;
+  if (idx >= PT_PER_SECTOR * PT_PER_SECTOR || inode->data.child == 0)
+    return 0;
+
+  disk_read (filesys_disk, inode->data.child, scratch);
+  if (scratch->pt[idx / PT_PER_SECTOR] == 0)
+    return 0;
+
+  disk_read (filesys_disk, scratch->pt[idx / PT_PER_SECTOR], scratch);
+  return scratch->pt[idx % PT_PER_SECTOR];
+}
+
+/* Writes index block SECTOR of INODE from BUFFER: in place if
+   it was allocated at the log head since the last commit, so
+   that nothing committed points at it yet, otherwise through the
+   journal. */
+static void
+index_write (struct inode *inode, disk_sector_t sector, const void *buffer)
+{
+  if (is_logged (inode) && free_map_fresh (sector))
+    disk_write (filesys_disk, sector, buffer);
+  else
+    journal_write (sector, buffer);
+}
+
+/* Copies the sector *PTR, which holds BLOCK of INODE, to a newly
+   allocated sector at the log head, points *PTR at the copy and
+   appends the old sector to OLD, to be released once the
+   pointer change is logged.  Returns false if the disk is
+   full. */
+static bool
+index_move (struct inode *inode, disk_sector_t *ptr, unsigned block,
+            struct sector_list *old)
+{
+  disk_sector_t sector;
+
+  if (free_map_allocate (1, &sector) == false)
+    return false;
+  disk_copy (filesys_disk, sector, *ptr);
+  free_map_set_owner (sector, inode->sector, block);
+  old->sectors[old->cnt++] = *ptr;
+  *ptr = sector;
+  return true;
+}
+
+/* Before index block *PTR, BLOCK of INODE, changes: in log mode
+   moves it to the log head unless it is already there, as
+   index_move() does.  Returns true if it moved.  If the disk is
+   full the block stays and is changed through the journal. */
+static bool
+index_cow (struct inode *inode, disk_sector_t *ptr, unsigned block,
+           struct sector_list *old)
+{
+  return (is_logged (inode) && free_map_fresh (*ptr) == false
+          && index_move (inode, ptr, block, old));
+}
+
+/* Makes SECTOR hold data sector IDX of INODE, allocating any index
+   blocks on the way, using SCRATCH as a sector-sized buffer.
+   In log mode, index blocks that have to change are moved to the
+   log head first, and SECTOR is recorded as IDX of INODE in its
+   segment summary.
+   Returns false if the disk is full or IDX is past the largest
+   file size. */
+static bool
+index_install (struct inode *inode, size_t idx, disk_sector_t sector,
+               struct inode_child *scratch)
+{
+  disk_sector_t old_sectors[2];
+  struct sector_list old = { old_sectors, 0 };
+  disk_sector_t lv1;
+  size_t k;
+  bool success = false;
+
+  if (sector != 0 && (inode->data.flags & INODE_COMPRESSED) == 0)
+    free_map_set_owner (sector, inode->sector, idx);
+
+  if (idx < DIRECT_CNT)
+  {
+    inode->data.direct[idx] = sector;
+    inode->dirty = true;
+    return true;
+  }
+
+  idx -= DIRECT_CNT;
+  if (idx >= PT_PER_SECTOR * PT_PER_SECTOR)
+    return false;
+  k = idx / PT_PER_SECTOR;
+
+  if (inode->data.child == 0)
+  {
+    if (free_map_allocate (1, &inode->data.child) == false)
+      return false;
+    free_map_set_owner (inode->data.child, inode->sector, BLOCK_TOP);
+    memset (scratch, 0, sizeof *scratch);
+    index_write (inode, inode->data.child, scratch);
+    inode->dirty = true;
+  }
+  else if (index_cow (inode, &inode->data.child, BLOCK_TOP, &old))
+    inode->dirty = true;
+
+  disk_read (filesys_disk, inode->data.child, scratch);
+  lv1 = scratch->pt[k];
+  if (lv1 == 0)
+  {
+    if (free_map_allocate (1, &lv1) == false)
+      goto done;
+    free_map_set_owner (lv1, inode->sector, BLOCK_LV1 (k));
+    scratch->pt[k] = lv1;
+    index_write (inode, inode->data.child, scratch);
+    memset (scratch, 0, sizeof *scratch);
+  }
+  else
+  {
+    if (index_cow (inode, &scratch->pt[k], BLOCK_LV1 (k), &old))
+    {
+      lv1 = scratch->pt[k];
+      index_write (inode, inode->data.child, scratch);
+    }
+    disk_read (filesys_disk, lv1, scratch);
+  }
+
+  scratch->pt[idx % PT_PER_SECTOR] = sector;
+  index_write (inode, lv1, scratch);
+  success = true;
+
+ done:
+  /* The blocks moved away from are free once the inode that
+     points past them is logged. */
+  if (old.cnt > 0)
+  {
+    inode_flush (inode);
+    journal_release (old.sectors, old.cnt);
+  }
+  return success;
+}
+
+/* Allocates a run of up to WANT consecutive free sectors,
+   halving the request until it fits.  Stores the first sector
+   in *START and the run length in *GOT.
+   Returns false only if the disk is completely full. */
+static bool
+allocate_run (size_t want, disk_sector_t *start, size_t *got)
+{
+  size_t cnt;
+
+  for (cnt = want; cnt > 0; cnt /= 2)
+    if (free_map_allocate (cnt, start))
+    {
+      *got = cnt;
+      return true;
+    }
+
+  return false;
+}
+
+/* Hands out the next data sector for INODE from its allocation
+   window, reserving a new window when the old one runs out.
+
+   Each open inode claims a run of consecutive sectors at a time
+   and fills it as it grows, so files that are extended at the
+   same time end up in separate contiguous runs instead of
+   interleaved sector by sector.  Windows double while a file
+   keeps growing, up to WINDOW_MAX.  Whatever is left is given
+   back when the inode is closed.  In log mode every allocation
+   already comes from the log head, so there is no window.
+   Returns false if the disk is full. */
+static bool
+window_allocate (struct inode *inode, disk_sector_t *sector)
+{
+  if (free_map_log_mode ())
+    return free_map_allocate (1, sector);
+
+  if (inode->window_left == 0)
+  {
+    if (allocate_run (inode->window_size, &inode->window, &inode->window_left) == false)
+      return false;
+    if (inode->window_size < WINDOW_MAX) inode->window_size *= 2;
+  }
+
+  *sector = inode->window++;
+  inode->window_left--;
+  return true;
+}
+
+/* Returns the sector that holds data sector IDX of INODE,
+   allocating one if it is a hole.  Sets *FRESH to true if the
+   sector was just allocated, so its old contents are garbage.
+   Returns 0 if the disk is full. */
+static disk_sector_t
+index_to_sector_alloc (struct inode *inode, size_t idx, bool *fresh,
+                       struct inode_child *scratch)
+{
+  disk_sector_t sector = index_to_sector (inode, idx, scratch);
+
+  *fresh = false;
+  if (sector != 0) return sector;
+
+  if (window_allocate (inode, &sector) == false)
+    return 0;
+  if (index_install (inode, idx, sector, scratch) == false)
+  {
+    free_map_release (sector, 1);
+    return 0;
+  }
+
+  *fresh = true;
+  return sector;
+}
+
+/* Drops INODE's chunks from the decompressed chunk cache. */
+static void
+chunk_invalidate (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < CHUNK_CACHE_CNT; i++)
+    if (chunk_cache[i].inode == inode)
+      chunk_cache[i].inode = NULL;
+}
+
+/* Reads chunk CHUNK of compressed INODE into DATA, using SCRATCH
+   as a sector-sized buffer.  Holes read as zeros.
+   Returns false if the chunk on disk is corrupt. */
+static bool
+chunk_load (struct inode *inode, size_t chunk, uint8_t *data,
+            struct inode_child *scratch)
+{
+  size_t idx = chunk * CHUNK_SECTORS;
+  disk_sector_t start = index_to_sector (inode, idx, scratch);
+  size_t size, i;
+
+  if (start == 0)
+  {
+    memset (data, 0, CHUNK_SIZE);
+    return true;
+  }
+
+  size = index_to_sector (inode, idx + 1, scratch);
+  if (size == CHUNK_SIZE)
+  {
+    for (i = 0; i < CHUNK_SECTORS; i++)
+      disk_read (filesys_disk, start + i, data + i * DISK_SECTOR_SIZE);
+    return true;
+  }
+
+  for (i = 0; i < bytes_to_sectors (size); i++)
+    disk_read (filesys_disk, start + i, chunk_packed + i * DISK_SECTOR_SIZE);
+  return lz_decompress (chunk_packed, size, data, CHUNK_SIZE) == CHUNK_SIZE;
+}
+
+/* Compresses DATA and writes it as chunk CHUNK of INODE into a
+   newly allocated run, then frees the chunk's old run.  A chunk
+   of all zeros becomes a hole, and one that would not save a
+   sector is stored uncompressed.  Uses SCRATCH as a sector-sized
+   buffer.  Returns false if the disk is full. */
+static bool
+chunk_store (struct inode *inode, size_t chunk, const uint8_t *data,
+             struct inode_child *scratch)
+{
+  size_t idx = chunk * CHUNK_SECTORS;
+  disk_sector_t old = index_to_sector (inode, idx, scratch);
+  size_t old_size = old != 0 ? index_to_sector (inode, idx + 1, scratch) : 0;
+  disk_sector_t start = 0;
+  const uint8_t *src = data;
+  size_t size = 0, sectors, i;
+
+  for (i = 0; i < CHUNK_SIZE; i++)
+    if (data[i] != 0)
+      break;
+
+  if (i < CHUNK_SIZE)
+  {
+    size = lz_compress (data, CHUNK_SIZE, chunk_packed,
+                        CHUNK_SIZE - DISK_SECTOR_SIZE, chunk_work);
+    if (size == 0)
+      size = CHUNK_SIZE;
+    else
+    {
+      memset (chunk_packed + size, 0,
+              bytes_to_sectors (size) * DISK_SECTOR_SIZE - size);
+      src = chunk_packed;
+    }
+
+    sectors = bytes_to_sectors (size);
+    if (free_map_allocate (sectors, &start) == false)
+      return false;
+    for (i = 0; i < sectors; i++)
+      data_write (inode, start + i, src + i * DISK_SECTOR_SIZE);
+  }
+
+  if (index_install (inode, idx, start, scratch) == false
+      || index_install (inode, idx + 1, size, scratch) == false)
+  {
+    if (start != 0) free_map_release (start, bytes_to_sectors (size));
+    return false;
+  }
+
+  if (old != 0) free_map_release (old, bytes_to_sectors (old_size));
+  return true;
+}
+
+/* Returns the decompressed contents of chunk CHUNK of compressed
+   INODE, reading it in if it is not cached.  Uses SCRATCH as a
+   sector-sized buffer.  Returns a null pointer if the chunk is
+   corrupt or memory runs out. */
+static struct chunk_entry *
+chunk_get (struct inode *inode, size_t chunk, struct inode_child *scratch)
+{
+  struct chunk_entry *e;
+  size_t i;
+
+  for (i = 0; i < CHUNK_CACHE_CNT; i++)
+  {
+    e = &chunk_cache[i];
+    if (e->inode == inode && e->chunk == chunk)
+    {
+      e->accessed = true;
+      return e;
+    }
+  }
+
+  /* Second chance: pass over recently used entries once. */
+  for (;;)
+  {
+    e = &chunk_cache[chunk_hand];
+    chunk_hand = (chunk_hand + 1) % CHUNK_CACHE_CNT;
+    if (e->inode == NULL || e->accessed == false)
+      break;
+    e->accessed = false;
+  }
+
+  e->inode = NULL;
+  if (e->data == NULL)
+  {
+    e->data = palloc_get_page (0);
+    if (e->data == NULL)
+      return NULL;
+  }
+  if (chunk_load (inode, chunk, e->data, scratch) == false)
+    return NULL;
+
+  e->inode = inode;
+  e->chunk = chunk;
+  e->accessed = true;
+  return e;
+}
+
+/* Reads up to SIZE bytes at OFFSET from compressed INODE into
+   BUFFER.  Returns the number of bytes read. */
+static off_t
+compressed_read (struct inode *inode, uint8_t *buffer, off_t size,
+                 off_t offset)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct inode_child *scratch = malloc (sizeof *scratch);
+  off_t length = inode_length (inode);
+  off_t bytes_read = 0;
+
+  if (scratch == NULL) goto done;
+  if (offset >= length) size = 0;
+  else if (size > length - offset) size = length - offset;
+
+  while (size > 0)
+  {
+    struct chunk_entry *e = chunk_get (inode, offset / CHUNK_SIZE, scratch);
+    int chunk_ofs = offset % CHUNK_SIZE;
+    int chunk_size = size < CHUNK_SIZE - chunk_ofs ? size : CHUNK_SIZE - chunk_ofs;
+
+    if (e == NULL)
+      break;
+    memcpy (buffer + bytes_read, e->data + chunk_ofs, chunk_size);
+
+    size -= chunk_size;
+    offset += chunk_size;
+    bytes_read += chunk_size;
+  }
+
+  free (scratch);
+
+ done:
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET into compressed INODE,
+   recompressing each chunk touched.  Returns the number of bytes
+   written, which may be less than SIZE if the disk fills up. */
+static off_t
+compressed_write (struct inode *inode, const uint8_t *buffer, off_t size,
+                  off_t offset)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct inode_child *scratch = malloc (sizeof *scratch);
+  off_t bytes_written = 0;
+
+  if (scratch == NULL) goto done;
+
+  while (size > 0)
+  {
+    size_t chunk = offset / CHUNK_SIZE;
+    struct chunk_entry *e;
+    int chunk_ofs = offset % CHUNK_SIZE;
+    int chunk_size = size < CHUNK_SIZE - chunk_ofs ? size : CHUNK_SIZE - chunk_ofs;
+
+    if (chunk * CHUNK_SECTORS >= MAX_SECTORS)
+      break;
+    e = chunk_get (inode, chunk, scratch);
+    if (e == NULL)
+      break;
+
+    memcpy (e->data + chunk_ofs, buffer + bytes_written, chunk_size);
+    if (chunk_store (inode, chunk, e->data, scratch) == false)
+    {
+      /* The cached copy no longer matches the disk. */
+      e->inode = NULL;
+      break;
+    }
+
+    size -= chunk_size;
+    offset += chunk_size;
+    bytes_written += chunk_size;
+  }
+
+  if (inode_length (inode) < offset && bytes_written > 0)
+  {
+    inode->data.length = offset;
+    inode->dirty = true;
+  }
+
+  free (scratch);
+
+ done:
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return bytes_written;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+{
+  io_wait (inode, false);
+  if (inode->data.flags & INODE_INLINE)
+    return inline_read (inode, buffer_, size, offset);
+  if (inode->data.flags & INODE_COMPRESSED)
+    return compressed_read (inode, buffer_, size, offset);
+
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+  uint8_t *bounce = NULL;
+  struct inode_child *scratch = malloc (sizeof *scratch);
+
+  if (scratch == NULL) return 0;
+
+  while (size > 0) 
+    {
+      if (inode_length (inode) < offset) break;
+
+      /* Disk sector to read, starting byte offset within sector. */
+      disk_sector_t sector_idx = index_to_sector (inode, offset / DISK_SECTOR_SIZE, scratch);
+      int sector_ofs = offset % DISK_SECTOR_SIZE;
+
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      off_t inode_left = inode_length (inode) - offset;
+      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+      /* Number of bytes to actually copy out of this sector. */
+      int chunk_size = size < min_left ? size : min_left;
+      if (chunk_size <= 0)
+        break;
+
+      if (sector_idx == 0)
+      {
+        /* Holes read as zeros. */
+        memset (buffer + bytes_read, 0, chunk_size);
+      }
+
+      else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+      {
+        /* Read full sector directly into caller's buffer. */
+        disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+      }
+
+      else 
+      {
+        /* Read sector into bounce buffer, then partially copy
+           into caller's buffer. */
+        if (bounce == NULL) 
+        {
+          bounce = malloc (DISK_SECTOR_SIZE);
+          if (bounce == NULL)
+            break;
+        }
+        disk_read (filesys_disk, sector_idx, bounce);
+        memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+      }
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  free (bounce);
+  free (scratch);
+
+  return bytes_read;
+}
+
+/* Reads up to SECTORS data sectors of INODE, starting with the
+   one holding OFFSET, into the buffer cache ahead of use.  Runs
+   of consecutive sectors are read with one command each.  Holes
+   and sectors past the end of the file are skipped, as are
+   inline and compressed files, which have their own caching. */
+void
+inode_prefetch (struct inode *inode, off_t offset, size_t sectors)
+{
+  size_t idx = offset / DISK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (inode_length (inode));
+  struct inode_child *scratch;
+  disk_sector_t run = 0;
+  size_t run_cnt = 0;
+
+  if (inode->data.flags & (INODE_INLINE | INODE_COMPRESSED))
+    return;
+  if (end > idx + sectors)
+    end = idx + sectors;
+  if (idx >= end)
+    return;
+
+  scratch = malloc (sizeof *scratch);
+  if (scratch == NULL)
+    return;
+
+  for (; idx < end; idx++)
+  {
+    disk_sector_t sector = index_to_sector (inode, idx, scratch);
+
+    if (run_cnt > 0
+        && (sector != run + run_cnt || run_cnt == CACHE_PREFETCH_MAX))
+    {
+      disk_prefetch (filesys_disk, run, run_cnt);
+      run_cnt = 0;
+    }
+    if (sector != 0)
+    {
+      if (run_cnt == 0)
+        run = sector;
+      run_cnt++;
+    }
+  }
+  if (run_cnt > 0)
+    disk_prefetch (filesys_disk, run, run_cnt);
+
+  free (scratch);
+}
+
+/* Marks the cached data sectors of INODE holding the SIZE bytes
+   starting at OFFSET as the next to be evicted, for data that
+   will not be read again. */
+void
+inode_cool (struct inode *inode, off_t offset, off_t size)
+{
+  struct inode_child *scratch;
+  size_t idx, end;
+
+  if (size <= 0 || (inode->data.flags & (INODE_INLINE | INODE_COMPRESSED)))
+    return;
+
+  scratch = malloc (sizeof *scratch);
+  if (scratch == NULL)
+    return;
+
+  end = DIV_ROUND_UP (offset + size, DISK_SECTOR_SIZE);
+  for (idx = offset / DISK_SECTOR_SIZE; idx < end; idx++)
+  {
+    disk_sector_t sector = index_to_sector (inode, idx, scratch);
+    if (sector != 0)
+      disk_cool (filesys_disk, sector);
+  }
+
+  free (scratch);
+}
+
+/* Drops SECTOR from the buffer cache if it is clean.  A
+   sector_func. */
+static void
+evict_sector (disk_sector_t sector, void *aux UNUSED)
+{
+  disk_evict (filesys_disk, sector);
+}
+
+/* Drops INODE's clean data sectors and decompressed chunks from
+   the caches.  Dirty sectors stay until written back. */
+void
+inode_drop_cache (struct inode *inode)
+{
+  chunk_invalidate (inode);
+  walk_sectors (inode, false, evict_sector, NULL);
+}
+
+static off_t write_at (struct inode *, const uint8_t *buffer, off_t size,
+                       off_t offset, struct inode *src, off_t src_ofs);
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends the inode. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  io_wait (inode, true);
+  if (inode->deny_write_cnt)
+    return 0;
+
+  if (inode->data.flags & INODE_INLINE)
+  {
+    if (offset + size <= INODE_INLINE_MAX)
+      return inline_write (inode, buffer_, size, offset);
+
+    if (inline_migrate (inode) == false)
+      return 0;
+  }
+  if (inode->data.flags & INODE_COMPRESSED)
+    return compressed_write (inode, buffer_, size, offset);
+
+  return write_at (inode, buffer_, size, offset, NULL, 0);
+}
+
+/* Copies SIZE bytes of SRC starting at SRC_OFS into DST starting
+   at DST_OFS, without a caller buffer, and returns the number of
+   bytes copied.  Stops at the end of SRC or if the disk fills up.
+   Copies nothing if DST and SRC are the same inode and the ranges
+   overlap.  When both offsets fall at the same place within a
+   sector, whole sectors go from one cache slot to another through
+   disk_copy(); otherwise, and for inline or compressed files, the
+   data goes through a kernel page. */
+off_t
+inode_copy (struct inode *dst, off_t dst_ofs, struct inode *src,
+            off_t src_ofs, off_t size)
+{
+  /* Waiting for one may let the other change hands. */
+  while (io_busy (dst, true) || io_busy (src, false))
+  {
+    io_wait (dst, true);
+    io_wait (src, false);
+  }
+
+  off_t src_left = inode_length (src) - src_ofs;
+  off_t bytes_copied = 0;
+  uint8_t *page;
+
+  if (size > src_left)
+    size = src_left;
+  if (size <= 0 || dst->deny_write_cnt)
+    return 0;
+  if (dst == src && dst_ofs < src_ofs + size && src_ofs < dst_ofs + size)
+    return 0;
+
+  if (((dst->data.flags | src->data.flags) & (INODE_INLINE | INODE_COMPRESSED)) == 0)
+    return write_at (dst, NULL, size, dst_ofs, src, src_ofs);
+
+  page = palloc_get_page (0);
+  if (page == NULL)
+    return 0;
+
+  while (bytes_copied < size)
+  {
+    off_t chunk = size - bytes_copied < PGSIZE ? size - bytes_copied : PGSIZE;
+    off_t n = inode_read_at (src, page, chunk, src_ofs + bytes_copied);
+
+    n = inode_write_at (dst, page, n, dst_ofs + bytes_copied);
+    bytes_copied += n;
+    if (n < chunk)
+      break;
+  }
+  palloc_free_page (page);
+  return bytes_copied;
+}
+
+/* Does the work of inode_write_at() and inode_copy() for an
+   INODE that is neither inline nor compressed.  Writes SIZE
+   bytes starting at OFFSET from BUFFER or, if BUFFER is null,
+   from SRC starting at SRC_OFS. */
+static off_t
+write_at (struct inode *inode, const uint8_t *buffer, off_t size,
+          off_t offset, struct inode *src, off_t src_ofs)
+{
+  static const uint8_t zeros[DISK_SECTOR_SIZE];
+  off_t bytes_written = 0;
+  off_t old_length = inode_length (inode);
+  uint8_t *bounce = NULL;
+  struct inode_child *scratch;
+  struct inode_child *src_scratch = NULL;
+  disk_sector_t *moved = NULL;
+  size_t moved_cnt = 0;
+  bool relocate;
+  bool fresh;
+
+  scratch = malloc (sizeof *scratch);
+  if (scratch == NULL) return 0;
+  if (buffer == NULL && (src_scratch = malloc (sizeof *src_scratch)) == NULL)
+  {
+    free (scratch);
+    return 0;
+  }
+
+  /* In log mode, overwritten data is written to the head of the
+     log, unless it was put there since the last commit.  The old
+     sectors go to journal_release() only after the index that
+     points past them is logged, so they are reused only once
+     that is committed.  Metadata is already logged by the
+     journal. */
+  relocate = is_logged (inode);
+
+  if (inode_length (inode) < offset + size)
+  {
+    inode->data.length = offset + size;
+    inode->dirty = true;
+  }
+  
+  while (size > 0) 
+    {
+      /* Sector to write, starting byte offset within sector. */
+      disk_sector_t sector_idx = index_to_sector_alloc (inode, offset / DISK_SECTOR_SIZE, &fresh, scratch);
+      int sector_ofs = offset % DISK_SECTOR_SIZE;
+
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      off_t inode_left = inode_length (inode) - offset;
+      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+      /* Number of bytes to actually write into this sector. */
+      int chunk_size = size < min_left ? size : min_left;
+      if (chunk_size <= 0 || sector_idx == 0)
+        break;
+
+      /* Old home of data being relocated, 0 if none.  Sectors
+         shared with a clone are copied on first write. */
+      disk_sector_t old_idx = 0;
+      if (fresh == false
+          && ((relocate && free_map_fresh (sector_idx) == false)
+              || free_map_shared (sector_idx)))
+      {
+        disk_sector_t new_idx;
+
+        if (moved == NULL && (moved = palloc_get_page (0)) == NULL)
+          break;
+        if (window_allocate (inode, &new_idx) == false)
+          break;
+        if (index_install (inode, offset / DISK_SECTOR_SIZE, new_idx, scratch) == false)
+        {
+          free_map_release (new_idx, 1);
+          break;
+        }
+
+        old_idx = sector_idx;
+        sector_idx = new_idx;
+        moved[moved_cnt++] = old_idx;
+        if (moved_cnt == PGSIZE / sizeof *moved)
+        {
+          inode_flush (inode);
+          journal_release (moved, moved_cnt);
+          moved_cnt = 0;
+        }
+      }
+
+      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE && buffer != NULL) 
+        {
           /* Write full sector directly to disk. */
-          disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+          data_write (inode, sector_idx, buffer + bytes_written); 
+        }
+      else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE
+               && (src_ofs + bytes_written) % DISK_SECTOR_SIZE == 0
+               && !is_metadata (inode))
+        {
+          /* Copy a whole source sector from cache to cache. */
+          disk_sector_t src_idx = index_to_sector (src, (src_ofs + bytes_written) / DISK_SECTOR_SIZE, src_scratch);
+          if (src_idx != 0)
+          {
+            disk_copy (filesys_disk, sector_idx, src_idx);
+            note_dirty (inode, sector_idx);
+          }
+          else
+            data_write (inode, sector_idx, zeros);
         }
       else 
         {
@@ -503,13 +1762,18 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
           /* If the sector contains data before or after the chunk
              we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            disk_read (filesys_disk, sector_idx, bounce);
+             first.  Otherwise, or if the sector was a hole until
+             now, we start with a sector of all zeros. */
+          if (fresh == false && (sector_ofs > 0 || chunk_size < sector_left)) 
+            disk_read (filesys_disk, old_idx != 0 ? old_idx : sector_idx, bounce);
           else
             memset (bounce, 0, DISK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          disk_write (filesys_disk, sector_idx, bounce); 
+          if (buffer != NULL)
+            memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
+          else if (inode_read_at (src, bounce + sector_ofs, chunk_size,
+                                  src_ofs + bytes_written) != chunk_size)
+            break;
+          data_write (inode, sector_idx, bounce); 
         }
 
       /* Advance. */
@@ -517,15 +1781,613 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
-  palloc_free_page (tmp1);
-  palloc_free_page (tmp2);
 
- // if (isLockAcquired == true) lock_release (&file_lock);
+  /* If the disk filled up, don't claim bytes that were never
+     written. */
+  if (size > 0 && inode_length (inode) > offset)
+  {
+    inode->data.length = offset > old_length ? offset : old_length;
+    inode->dirty = true;
+  }
+
+  if (moved_cnt > 0)
+  {
+    inode_flush (inode);
+    journal_release (moved, moved_cnt);
+  }
+  if (moved != NULL) palloc_free_page (moved);
+  free (bounce);
+  free (scratch);
+  free (src_scratch);
 
   return bytes_written;
 }
 
+/* Reserves disk space for the SIZE bytes of INODE starting at
+   OFFSET, filling any holes in that range with zeroed sectors
+   taken from runs that are as contiguous as the free map allows.
+   Extends the inode if the range passes end of file.
+   Returns true if successful, false if writes are denied or the
+   disk fills up. */
+bool
+inode_preallocate (struct inode *inode, off_t offset, off_t size)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct inode_child *scratch = malloc (sizeof *scratch);
+  static char zeros[DISK_SECTOR_SIZE];
+  size_t first, last, idx, holes = 0;
+  disk_sector_t run = 0;
+  size_t run_left = 0;
+  bool success = true;
+
+  ASSERT (offset >= 0 && size >= 0);
+
+  io_wait (inode, true);
+
+  /* Compressed chunks are sized by their contents, so space
+     cannot be reserved ahead of the data. */
+  if (inode->deny_write_cnt || scratch == NULL
+      || (inode->data.flags & INODE_COMPRESSED))
+  {
+    success = false;
+    goto done;
+  }
+  if (size == 0) goto done;
+
+  /* Space for inline data is already reserved in the inode. */
+  if (inode->data.flags & INODE_INLINE)
+  {
+    if (offset + size <= INODE_INLINE_MAX)
+      goto extend;
+    if (inline_migrate (inode) == false)
+    {
+      success = false;
+      goto done;
+    }
+  }
+
+  first = offset / DISK_SECTOR_SIZE;
+  last = (offset + size - 1) / DISK_SECTOR_SIZE;
+  if (last >= MAX_SECTORS)
+  {
+    success = false;
+    goto done;
+  }
+
+  /* Count the holes first so the data can come from one run. */
+  for (idx = first; idx <= last; idx++)
+    if (index_to_sector (inode, idx, scratch) == 0) holes++;
+
+  for (idx = first; idx <= last && holes > 0; idx++)
+  {
+    if (index_to_sector (inode, idx, scratch) != 0) continue;
+
+    if (run_left == 0 && allocate_run (holes, &run, &run_left) == false)
+    {
+      success = false;
+      break;
+    }
+    if (index_install (inode, idx, run, scratch) == false)
+    {
+      success = false;
+      break;
+    }
+    data_write (inode, run, zeros);
+
+    run++;
+    run_left--;
+    holes--;
+  }
+
+  /* Give back whatever is left of a partly used run. */
+  if (run_left > 0) free_map_release (run, run_left);
+
+  if (success == false) goto done;
+
+ extend:
+  if (inode_length (inode) < offset + size)
+  {
+    inode->data.length = offset + size;
+    inode->dirty = true;
+  }
+
+ done:
+  free (scratch);
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return success;
+}
+
+/* Returns the number of extents in INODE: maximal runs of data
+   sectors that lie in consecutive sectors on disk.  A hole ends
+   an extent.  Inline files have none. */
+size_t
+inode_extents (struct inode *inode)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  io_wait (inode, false);
+
+  struct inode_child *scratch = palloc_get_page (PAL_ASSERT);
+  size_t sectors = bytes_to_sectors (inode->data.length);
+  size_t extents = 0, idx;
+  disk_sector_t prev = 0;
+
+  if (inode->data.flags & INODE_COMPRESSED)
+  {
+    /* Count chunk runs, which may follow one another. */
+    for (idx = 0; idx < sectors && idx < MAX_SECTORS; idx += CHUNK_SECTORS)
+    {
+      disk_sector_t start = index_to_sector (inode, idx, scratch);
+      if (start != 0 && start != prev) extents++;
+      prev = start != 0 ? start + bytes_to_sectors (index_to_sector (inode, idx + 1, scratch)) : 0;
+    }
+  }
+  else if ((inode->data.flags & INODE_INLINE) == 0)
+  {
+    for (idx = 0; idx < sectors && idx < MAX_SECTORS; idx++)
+    {
+      disk_sector_t sector = index_to_sector (inode, idx, scratch);
+      if (sector != 0 && (prev == 0 || sector != prev + 1)) extents++;
+      prev = sector;
+    }
+  }
+
+  palloc_free_page (scratch);
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return extents;
+}
+
+/* Copies sector FROM to sector TO, using BUFFER, and records FROM
+   in OLD and TO in MOVED. */
+static void
+defrag_move (disk_sector_t from, disk_sector_t to, void *buffer,
+             struct sector_list *old, struct sector_list *moved)
+{
+  disk_read (filesys_disk, from, buffer);
+  disk_write (filesys_disk, to, buffer);
+  old->sectors[old->cnt++] = from;
+  moved->sectors[moved->cnt++] = to;
+}
+
+/* Moves INODE's data sectors and index blocks into a single run
+   of consecutive sectors, laid out in file order with each
+   level-1 index block just before the data it maps:
+
+       direct data | top index | level-1 #0 | data | level-1 #1 | ...
+
+   Holes stay holes, and compressed files are left alone.
+
+   The run is allocated up front and filled in steps small enough
+   for one transaction each: the direct sectors, then one level-1
+   block and its data at a time, then the top index block.  Each
+   step writes its data home before committing the index that
+   points at it, updates the old top block in place, and hands
+   the sectors it replaced to journal_release(), so a crash
+   between steps leaves a consistent file, part moved and part
+   not, and only leaks the unused tail of the run.  Runs under
+   file_lock, so concurrent readers and writers never see a
+   half-moved file.
+   Returns false if INODE holds metadata, memory runs out or no
+   free run is large enough.  Also returns false in the
+   log-structured layout, where the log head and the segment
+   cleaner decide placement. */
+bool
+inode_defrag (struct inode *inode)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct inode_child *top = NULL, *lv1 = NULL;
+  uint8_t *buffer = NULL;
+  struct sector_list old = { NULL, 0 }, moved = { NULL, 0 };
+  size_t total = 0;
+  disk_sector_t start, next;
+  bool success = true;
+  size_t i, j;
+
+  io_wait (inode, true);
+
+  /* Metadata is updated through the journal in place; moving it
+     would need every step journaled, data and all. */
+  if (is_metadata (inode) || free_map_log_mode ())
+  {
+    success = false;
+    goto done;
+  }
+  /* Each compressed chunk already sits in a single run. */
+  if ((inode->data.flags & (INODE_INLINE | INODE_COMPRESSED))
+      || inode_extents (inode) <= 1)
+    goto done;
+
+  release_window (inode);
+
+  top = palloc_get_page (PAL_ASSERT);
+  lv1 = palloc_get_page (PAL_ASSERT);
+  buffer = palloc_get_page (PAL_ASSERT);
+
+  /* Count every sector the file owns. */
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (inode->data.direct[i] != 0) total++;
+  if (inode->data.child != 0)
+  {
+    disk_read (filesys_disk, inode->data.child, top);
+    total++;
+    for (i = 0; i < PT_PER_SECTOR; i++)
+    {
+      if (top->pt[i] == 0) continue;
+      disk_read (filesys_disk, top->pt[i], lv1);
+      total++;
+      for (j = 0; j < PT_PER_SECTOR; j++)
+        if (lv1->pt[j] != 0) total++;
+    }
+  }
+
+  /* One step moves at most a level-1 block and its data. */
+  old.sectors = malloc ((PT_PER_SECTOR + 1) * sizeof *old.sectors);
+  moved.sectors = malloc (PT_PER_SECTOR * sizeof *moved.sectors);
+  if (old.sectors == NULL || moved.sectors == NULL
+      || free_map_allocate (total, &start) == false)
+  {
+    success = false;
+    goto done;
+  }
+
+  next = start;
+  for (i = 0; i < DIRECT_CNT; i++)
+  {
+    if (inode->data.direct[i] == 0) continue;
+    defrag_move (inode->data.direct[i], next, buffer, &old, &moved);
+    inode->data.direct[i] = next++;
+  }
+  if (old.cnt > 0)
+  {
+    disk_sync (filesys_disk, moved.sectors, moved.cnt);
+    journal_begin ();
+    inode->dirty = true;
+    inode_flush (inode);
+    journal_release (old.sectors, old.cnt);
+    journal_end ();
+    old.cnt = moved.cnt = 0;
+  }
+
+  if (inode->data.child != 0)
+  {
+    disk_sector_t old_top = inode->data.child;
+    disk_sector_t new_top = next++;
+
+    disk_read (filesys_disk, old_top, top);
+
+    for (i = 0; i < PT_PER_SECTOR; i++)
+    {
+      disk_sector_t new_lv1;
+
+      if (top->pt[i] == 0) continue;
+
+      new_lv1 = next++;
+      disk_read (filesys_disk, top->pt[i], lv1);
+
+      for (j = 0; j < PT_PER_SECTOR; j++)
+      {
+        if (lv1->pt[j] == 0) continue;
+        defrag_move (lv1->pt[j], next, buffer, &old, &moved);
+        lv1->pt[j] = next++;
+      }
+      old.sectors[old.cnt++] = top->pt[i];
+      top->pt[i] = new_lv1;
+
+      disk_sync (filesys_disk, moved.sectors, moved.cnt);
+      journal_begin ();
+      journal_write (new_lv1, lv1);
+      journal_write (old_top, top);
+      journal_release (old.sectors, old.cnt);
+      journal_end ();
+      old.cnt = moved.cnt = 0;
+    }
+
+    journal_begin ();
+    journal_write (new_top, top);
+    inode->data.child = new_top;
+    inode->dirty = true;
+    inode_flush (inode);
+    journal_release (&old_top, 1);
+    journal_end ();
+  }
+
+  ASSERT (next == start + total);
+
+ done:
+  free (old.sectors);
+  free (moved.sectors);
+  if (top != NULL) palloc_free_page (top);
+  if (lv1 != NULL) palloc_free_page (lv1);
+  if (buffer != NULL) palloc_free_page (buffer);
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return success;
+}
+
+/* Returns true if inode number INUMBER belongs to a removed
+   inode whose blocks are waiting to be freed or being freed. */
+static bool
+is_reclaiming (disk_sector_t inumber)
+{
+  struct list *lists[2] = { &reclaim_list, &reclaim_active };
+  struct list_elem *e;
+  size_t i;
+
+  for (i = 0; i < 2; i++)
+    for (e = list_begin (lists[i]); e != list_end (lists[i]);
+         e = list_next (e))
+      if (list_entry (e, struct inode, elem)->sector == inumber)
+        return true;
+  return false;
+}
+
+/* For the segment cleaner of the log-structured layout: if
+   SECTOR still holds BLOCK of inode number INUMBER, as its
+   segment summary says, moves it to the log head and points the
+   inode, its index or the inode map at the copy.  The old sector
+   is freed by the commit that logs the change.  Leaves alone
+   sectors that are shared with a clone, compressed files and
+   removed files.  The caller must hold file_lock, which waiting
+   for the inode's I/O may release.
+   Returns true if the sector moved. */
+bool
+inode_move_block (disk_sector_t inumber, unsigned block,
+                  disk_sector_t sector)
+{
+  disk_sector_t location = free_map_inode_sector (inumber);
+  disk_sector_t old_sectors[2];
+  struct sector_list old = { old_sectors, 0 };
+  struct inode_child *scratch;
+  struct inode *inode;
+  bool moved = false;
+
+  ASSERT (lock_held_by_current_thread (&file_lock));
+
+  if (location == 0 || location >= disk_size (filesys_disk)
+      || is_reclaiming (inumber))
+    return false;
+  scratch = malloc (sizeof *scratch);
+  if (scratch == NULL)
+    return false;
+  inode = inode_open (inumber);
+  if (inode == NULL)
+  {
+    free (scratch);
+    return false;
+  }
+
+  io_wait (inode, true);
+  if (inode->removed || inode->data.magic != INODE_MAGIC
+      || (inode->data.flags & INODE_COMPRESSED)
+      || ((inode->data.flags & INODE_INLINE) && block != BLOCK_INODE)
+      || free_map_shared (sector))
+    goto done;
+
+  journal_begin ();
+  if (block == BLOCK_INODE)
+  {
+    if (free_map_inode_sector (inumber) == sector
+        && place_inode (inumber, &inode->data))
+    {
+      inode->dirty = false;
+      moved = true;
+    }
+  }
+  else if (block == BLOCK_TOP)
+  {
+    if (inode->data.child == sector
+        && index_move (inode, &inode->data.child, BLOCK_TOP, &old))
+    {
+      inode->dirty = true;
+      moved = true;
+    }
+  }
+  else if (block & 0x80000000)
+  {
+    size_t k = block & ~0x80000000u;
+
+    if (k < PT_PER_SECTOR && inode->data.child != 0)
+    {
+      disk_read (filesys_disk, inode->data.child, scratch);
+      if (scratch->pt[k] == sector)
+      {
+        if (index_cow (inode, &inode->data.child, BLOCK_TOP, &old))
+          inode->dirty = true;
+        if (index_move (inode, &scratch->pt[k], BLOCK_LV1 (k), &old))
+        {
+          index_write (inode, inode->data.child, scratch);
+          moved = true;
+        }
+      }
+    }
+  }
+  else if (block < MAX_SECTORS
+           && (inode->data.flags & INODE_INLINE) == 0
+           && index_to_sector (inode, block, scratch) == sector)
+  {
+    disk_sector_t copy;
+
+    if (free_map_allocate (1, &copy))
+    {
+      disk_copy (filesys_disk, copy, sector);
+      if (index_install (inode, block, copy, scratch))
+      {
+        if (!is_metadata (inode))
+          note_dirty (inode, copy);
+        old.sectors[old.cnt++] = sector;
+        moved = true;
+      }
+      else
+        free_map_release (copy, 1);
+    }
+  }
+
+  if (old.cnt > 0)
+  {
+    inode_flush (inode);
+    journal_release (old.sectors, old.cnt);
+  }
+  journal_end ();
+
+ done:
+  inode_close (inode);
+  free (scratch);
+  return moved;
+}
+
+/* Adds 1 to the sector count in AUX. */
+static void
+count_sector (disk_sector_t sector UNUSED, void *cnt)
+{
+  (*(size_t *) cnt)++;
+}
+
+/* Appends SECTOR to the sector_list LIST. */
+static void
+collect_sector (disk_sector_t sector, void *list_)
+{
+  struct sector_list *list = list_;
+
+  list->sectors[list->cnt++] = sector;
+}
+
+/* Writes a clone of file SRC to inode sector SECTOR, or inode
+   number SECTOR in the log-structured layout.  The clone
+   gets its own inode and index blocks but shares SRC's data
+   sectors, whose reference counts go up by one.  Whichever file
+   is written first copies the sectors it changes, so the clone
+   takes no extra space until then.
+
+   Each index block copy is its own transaction, and the new inode
+   is written last, so no transaction outgrows the journal as long
+   as the caller has none open around this call.  A
+   crash before the inode commits leaks the copies and leaves the
+   shared sectors with one reference too many, but never frees a
+   sector that is still in use.
+   Returns false if SRC is a directory, the disk has no reference
+   counts, or memory or disk space runs out. */
+bool
+inode_clone (struct inode *src, disk_sector_t sector)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  struct inode_disk *disk_inode = malloc (sizeof *disk_inode);
+  struct inode_child *top = NULL, *lv1 = NULL;
+  struct sector_list shared = { NULL, 0 };
+  bool success = false;
+  size_t cnt = 0;
+  size_t i;
+
+  io_wait (src, false);
+  if (disk_inode == NULL || src->data.type != TYPE_FILE)
+    goto done;
+
+  memcpy (disk_inode, &src->data, sizeof *disk_inode);
+
+  walk_sectors (src, false, count_sector, &cnt);
+  if (cnt > 0)
+  {
+    shared.sectors = malloc (cnt * sizeof *shared.sectors);
+    if (shared.sectors == NULL)
+      goto done;
+    walk_sectors (src, false, collect_sector, &shared);
+  }
+  if (shared.cnt > 0 && free_map_share (shared.sectors, shared.cnt) == false)
+    goto done;
+
+  /* Index blocks are updated in place, so each file needs its
+     own copy. */
+  if ((src->data.flags & INODE_INLINE) == 0 && src->data.child != 0)
+  {
+    top = palloc_get_page (PAL_ASSERT);
+    lv1 = palloc_get_page (PAL_ASSERT);
+
+    disk_read (filesys_disk, src->data.child, top);
+    for (i = 0; i < PT_PER_SECTOR; i++)
+    {
+      disk_sector_t copy;
+
+      if (top->pt[i] == 0) continue;
+      if (free_map_allocate (1, &copy) == false)
+        break;
+      free_map_set_owner (copy, sector, BLOCK_LV1 (i));
+      disk_read (filesys_disk, top->pt[i], lv1);
+      journal_begin ();
+      journal_write (copy, lv1);
+      journal_end ();
+      top->pt[i] = copy;
+    }
+
+    if (i < PT_PER_SECTOR
+        || free_map_allocate (1, &disk_inode->child) == false)
+      goto undo;
+    free_map_set_owner (disk_inode->child, sector, BLOCK_TOP);
+  }
+
+  journal_begin ();
+  if (top != NULL)
+    journal_write (disk_inode->child, top);
+  if (sector < disk_size (filesys_disk))
+  {
+    journal_write (sector, disk_inode);
+    success = true;
+  }
+  else
+    success = place_inode (sector, disk_inode);
+  journal_end ();
+
+  if (success == false)
+  {
+    if (top != NULL) free_map_release (disk_inode->child, 1);
+    i = top != NULL ? PT_PER_SECTOR : 0;
+    goto undo;
+  }
+  goto done;
+
+ undo:
+  /* Free the copies made so far and drop the shares. */
+  while (i-- > 0)
+    if (top->pt[i] != 0) free_map_release (top->pt[i], 1);
+  if (shared.cnt > 0) free_map_release_batch (shared.sectors, shared.cnt);
+
+ done:
+  free (disk_inode);
+  free (shared.sectors);
+  if (top != NULL) palloc_free_page (top);
+  if (lv1 != NULL) palloc_free_page (lv1);
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -538,6 +2400,7 @@ inode_deny_write (struct inode *inode)
     isLockAcquired = true;
   }
 
+  io_wait (inode, false);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 
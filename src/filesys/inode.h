@@ -2,6 +2,7 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
@@ -13,16 +14,35 @@ enum file_status
 
 struct bitmap;
 
+/* inode_create() flags. */
+#define INODE_COMPRESSED 0x2            /* Store data compressed. */
+
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t, enum file_status);
+bool inode_create (disk_sector_t, off_t, enum file_status, unsigned flags);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
 enum file_status inode_get_type (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_flush (struct inode *);
+void inode_flush_all (void);
+bool inode_sync (struct inode *);
+bool inode_reclaim (void);
+void inode_io_begin (struct inode *, bool write);
+void inode_io_end (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_copy (struct inode *dst, off_t dst_ofs, struct inode *src,
+                  off_t src_ofs, off_t size);
+bool inode_preallocate (struct inode *, off_t offset, off_t size);
+size_t inode_extents (struct inode *);
+bool inode_defrag (struct inode *);
+bool inode_clone (struct inode *, disk_sector_t);
+bool inode_move_block (disk_sector_t inumber, unsigned block, disk_sector_t);
+void inode_prefetch (struct inode *, off_t offset, size_t sectors);
+void inode_cool (struct inode *, off_t offset, off_t size);
+void inode_drop_cache (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
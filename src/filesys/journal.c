@@ -0,0 +1,366 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/syscall.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inode sectors, index blocks, directory contents and the free
+   map are written with journal_write() instead of disk_write().
+   Each such sector is pinned in the buffer cache, so its new
+   contents cannot reach its home location early.  When enough
+   sectors have been logged and no transaction is open, they are
+   committed together (group commit):
+
+        1. In the log-structured layout, the sectors allocated
+           at the log head since the last commit, which the
+           logged sectors may point to, are written back with
+           free_map_sync_log().
+
+        2. The logged sectors are copied, in order, to the
+           journal blocks that follow the header, with a single
+           multi-sector write.
+
+        3. The header is written with the home sector of each
+           block.  Once it is on disk the commit is durable.
+
+        4. The sectors are unpinned and written home in ascending
+           order, runs of consecutive sectors together, and the
+           header is cleared.
+
+   If the machine stops between steps 3 and 4, journal_init()
+   replays the committed blocks at the next boot.
+
+   A transaction is never split: journal_begin() commits early,
+   when no transaction is open, unless JOURNAL_TXN_MAX more
+   sectors fit.
+
+   Sectors that a transaction stops using are handed to
+   journal_release() rather than freed at once.  They go back to
+   the free map only after the commit that stops referring to
+   them, so a crash can never leave an index pointing at a sector
+   that was freed and reused. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Commit once this many sectors have been logged and no
+   transaction is open. */
+#define JOURNAL_BATCH 24
+
+/* On-disk journal header.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    unsigned seq;                       /* Number of commits so far. */
+    unsigned cnt;                       /* Committed blocks, 0 if none. */
+    disk_sector_t home[JOURNAL_BLOCKS]; /* Home sector of each block. */
+    uint8_t unused[DISK_SECTOR_SIZE - 3 * sizeof (unsigned)
+                   - JOURNAL_BLOCKS * sizeof (disk_sector_t)];
+  };
+
+static struct journal_header *header;          /* Cached header. */
+static disk_sector_t logged[JOURNAL_BLOCKS];   /* Logged, uncommitted. */
+static size_t logged_cnt;                      /* Entries in logged[]. */
+static int running;                            /* Open transactions. */
+static bool ready;                             /* Journal in use? */
+
+/* Copies of the logged sectors for step 2 of a commit. */
+static uint8_t *blocks;
+static const void *block_ptrs[JOURNAL_BLOCKS];
+
+/* Sectors passed to journal_release().  The first freed_done of
+   them are covered by a finished commit and may be freed. */
+static disk_sector_t *freed;
+static size_t freed_cnt, freed_cap, freed_done;
+static bool releasing;                         /* In release_freed()? */
+
+/* Sectors handed to the free map per free_map_release_batch(). */
+#define RELEASE_CHUNK 64
+
+static void commit (void);
+static void release_freed (void);
+
+/* Initializes the journal.  If FORMAT is false, first replays
+   any transaction that was committed but not yet written home. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof *header == DISK_SECTOR_SIZE);
+
+  size_t i;
+
+  header = calloc (1, sizeof *header);
+  blocks = malloc (JOURNAL_BLOCKS * DISK_SECTOR_SIZE);
+  if (header == NULL || blocks == NULL)
+    PANIC ("journal header allocation failed");
+  for (i = 0; i < JOURNAL_BLOCKS; i++)
+    block_ptrs[i] = blocks + i * DISK_SECTOR_SIZE;
+
+  if (!format)
+  {
+    disk_read (filesys_disk, JOURNAL_SECTOR, header);
+
+    if (header->magic == JOURNAL_MAGIC
+        && header->cnt > 0 && header->cnt <= JOURNAL_BLOCKS)
+    {
+      uint8_t *buffer = malloc (DISK_SECTOR_SIZE);
+
+      if (buffer == NULL)
+        PANIC ("journal replay buffer allocation failed");
+
+      printf ("Replaying %u journaled sectors...", header->cnt);
+      for (i = 0; i < header->cnt; i++)
+      {
+        disk_read (filesys_disk, JOURNAL_SECTOR + 1 + i, buffer);
+        disk_write_through (filesys_disk, header->home[i], buffer);
+      }
+      printf ("done.\n");
+
+      free (buffer);
+    }
+    else if (header->magic != JOURNAL_MAGIC)
+      header->seq = 0;
+  }
+
+  header->magic = JOURNAL_MAGIC;
+  header->cnt = 0;
+  disk_write_through (filesys_disk, JOURNAL_SECTOR, header);
+
+  logged_cnt = 0;
+  running = 0;
+  freed_cnt = freed_done = 0;
+  ready = true;
+}
+
+/* Opens a transaction.  Sectors logged until the matching
+   journal_end() are committed together.  The transaction, along
+   with any nested in it, may log at most JOURNAL_TXN_MAX
+   sectors. */
+void
+journal_begin (void)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  if (ready == true && running == 0
+      && logged_cnt + JOURNAL_TXN_MAX > JOURNAL_BLOCKS)
+    commit ();
+  running++;
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Closes a transaction.  Commits the logged sectors once enough
+   of them have built up and no other transaction is open. */
+void
+journal_end (void)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ASSERT (running > 0);
+  if (--running == 0 && logged_cnt >= JOURNAL_BATCH)
+    commit ();
+  if (running == 0)
+    release_freed ();
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Writes metadata sector SECTOR from BUFFER through the journal.
+   Before the journal is initialized this is plain disk_write(). */
+void
+journal_write (disk_sector_t sector, const void *buffer)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  size_t i;
+
+  if (ready == false)
+  {
+    disk_write (filesys_disk, sector, buffer);
+    if (isLockAcquired == true) lock_release (&file_lock);
+    return;
+  }
+
+  for (i = 0; i < logged_cnt; i++)
+    if (logged[i] == sector)
+      break;
+
+  if (i == logged_cnt)
+  {
+    /* Committing now would split the open transaction. */
+    if (logged_cnt == JOURNAL_BLOCKS)
+    {
+      if (running > 0)
+        PANIC ("journal transaction logged more than %d sectors",
+               JOURNAL_TXN_MAX);
+      commit ();
+    }
+    logged[logged_cnt++] = sector;
+  }
+
+  disk_write_pinned (filesys_disk, sector, buffer);
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Commits everything logged so far, whether or not transactions
+   are open. */
+void
+journal_flush (void)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  if (ready == true)
+  {
+    commit ();
+    release_freed ();
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Frees the CNT sectors in SECTORS once everything logged so far
+   has been committed.  Call after logging the change that stops
+   using them. */
+void
+journal_release (const disk_sector_t *sectors, size_t cnt)
+{
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  if (ready == false)
+    free_map_release_batch (sectors, cnt);
+  else
+  {
+    if (freed_cnt + cnt > freed_cap)
+    {
+      size_t cap = freed_cap > 0 ? freed_cap : RELEASE_CHUNK;
+      disk_sector_t *p;
+
+      while (cap < freed_cnt + cnt)
+        cap *= 2;
+      p = realloc (freed, cap * sizeof *freed);
+      if (p == NULL)
+        PANIC ("journal free list allocation failed");
+      freed = p;
+      freed_cap = cap;
+    }
+    memcpy (freed + freed_cnt, sectors, cnt * sizeof *sectors);
+    freed_cnt += cnt;
+  }
+
+  if (isLockAcquired == true) lock_release (&file_lock);
+}
+
+/* Gives the sectors of freed[] that a finished commit covers
+   back to the free map.  Must be called with no transaction
+   open; the free map updates are transactions of their own. */
+static void
+release_freed (void)
+{
+  disk_sector_t chunk[RELEASE_CHUNK];
+
+  ASSERT (running == 0);
+
+  if (releasing == true)
+    return;
+  releasing = true;
+
+  while (freed_done > 0)
+  {
+    size_t n = freed_done < RELEASE_CHUNK ? freed_done : RELEASE_CHUNK;
+
+    memcpy (chunk, freed, n * sizeof *freed);
+    memmove (freed, freed + n, (freed_cnt - n) * sizeof *freed);
+    freed_cnt -= n;
+    freed_done -= n;
+    free_map_release_batch (chunk, n);
+  }
+
+  releasing = false;
+}
+
+/* Orders disk sector numbers for qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const disk_sector_t *a = a_;
+  const disk_sector_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Writes the logged sectors to the journal, commits them, and
+   then writes them home.  Afterward the sectors released so far
+   may be freed. */
+static void
+commit (void)
+{
+  size_t released = freed_cnt;
+  size_t i;
+
+  if (logged_cnt == 0)
+  {
+    freed_done = released;
+    return;
+  }
+
+  free_map_sync_log ();
+
+  /* Pinned sectors are still cached, so these reads are cheap. */
+  for (i = 0; i < logged_cnt; i++)
+  {
+    disk_read (filesys_disk, logged[i], blocks + i * DISK_SECTOR_SIZE);
+    header->home[i] = logged[i];
+  }
+  disk_write_through_multi (filesys_disk, JOURNAL_SECTOR + 1, logged_cnt,
+                            block_ptrs);
+
+  header->seq++;
+  header->cnt = logged_cnt;
+  disk_write_through (filesys_disk, JOURNAL_SECTOR, header);
+
+  /* Checkpoint.  Once unpinned, the sectors can go home in runs. */
+  qsort (logged, logged_cnt, sizeof *logged, compare_sectors);
+  for (i = 0; i < logged_cnt; i++)
+    disk_unpin (filesys_disk, logged[i]);
+  disk_sync (filesys_disk, logged, logged_cnt);
+
+  header->cnt = 0;
+  disk_write_through (filesys_disk, JOURNAL_SECTOR, header);
+
+  logged_cnt = 0;
+  freed_done = released;
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* On-disk journal region, reserved right after the root
+   directory inode: one header sector followed by the blocks. */
+#define JOURNAL_SECTOR 2        /* Journal header sector. */
+#define JOURNAL_BLOCKS 32       /* Metadata sectors per commit. */
+#define JOURNAL_SECTORS (1 + JOURNAL_BLOCKS)
+
+/* Most sectors one transaction may log.  journal_begin() makes
+   this much room, so a transaction is never split across commits;
+   bigger operations must be broken into transactions that each
+   leave the file system consistent. */
+#define JOURNAL_TXN_MAX 16
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (disk_sector_t, const void *);
+void journal_release (const disk_sector_t *, size_t cnt);
+void journal_flush (void);
+
+#endif /* filesys/journal.h */
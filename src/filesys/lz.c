@@ -0,0 +1,196 @@
+#include "filesys/lz.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* A small LZ77 codec in the style of LZ4, fast enough to run on
+   every write of a compressed file.
+
+   The output is a series of sequences.  Each begins with a token
+   byte whose high nibble is the number of literal bytes and
+   whose low nibble is the match length minus LZ_MIN_MATCH.  A
+   nibble of 15 is followed by extra length bytes, each added to
+   it, ending with the first byte below 255.  Then come the
+   literals, then the match offset as 2 little-endian bytes.  The
+   last sequence has literals only and ends the input. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+/* Returns the 4 bytes at P as an integer. */
+static inline uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t x;
+  memcpy (&x, p, sizeof x);
+  return x;
+}
+
+/* Hashes the 4 bytes SEQ into the match table. */
+static inline size_t
+hash (uint32_t seq)
+{
+  return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends LEN, less the 15 already in a token nibble, as extra
+   length bytes at *OP, not passing OEND.
+   Returns false if there is no room. */
+static bool
+put_length (uint8_t **op, uint8_t *oend, size_t len)
+{
+  for (; len >= 255; len -= 255)
+  {
+    if (*op >= oend) return false;
+    *(*op)++ = 255;
+  }
+  if (*op >= oend) return false;
+  *(*op)++ = len;
+  return true;
+}
+
+/* Appends a sequence of LIT_CNT literals from LIT followed, if
+   MATCH_LEN is nonzero, by a match MATCH_LEN bytes long at
+   OFFSET bytes back.  Returns false if there is no room. */
+static bool
+put_sequence (uint8_t **op, uint8_t *oend, const uint8_t *lit,
+              size_t lit_cnt, size_t offset, size_t match_len)
+{
+  size_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+  uint8_t *token = *op;
+
+  if (*op >= oend) return false;
+  *token = (lit_cnt < 15 ? lit_cnt : 15) << 4 | (ml < 15 ? ml : 15);
+  (*op)++;
+
+  if (lit_cnt >= 15 && !put_length (op, oend, lit_cnt - 15))
+    return false;
+  if ((size_t) (oend - *op) < lit_cnt)
+    return false;
+  memcpy (*op, lit, lit_cnt);
+  *op += lit_cnt;
+
+  if (match_len == 0)
+    return true;
+
+  if (oend - *op < 2) return false;
+  *(*op)++ = offset & 0xff;
+  *(*op)++ = offset >> 8;
+  if (ml >= 15 && !put_length (op, oend, ml - 15))
+    return false;
+
+  return true;
+}
+
+/* Compresses the N bytes at SRC into the CAP bytes at DST, using
+   WORK, which must be LZ_WORK_SIZE bytes, as scratch space.
+   Returns the compressed size, or 0 if it would not fit in CAP
+   bytes. */
+size_t
+lz_compress (const void *src_, size_t n, void *dst_, size_t cap,
+             void *work)
+{
+  const uint8_t *src = src_;
+  const uint8_t *ip = src, *anchor = src, *end = src + n;
+  uint8_t *op = dst_, *oend = op + cap;
+  uint16_t *table = work;
+
+  ASSERT (n <= LZ_MAX_INPUT);
+
+  /* Table entries are positions plus 1; 0 means empty. */
+  memset (table, 0, LZ_WORK_SIZE);
+
+  while (end - ip >= LZ_MIN_MATCH)
+  {
+    uint32_t seq = read32 (ip);
+    size_t h = hash (seq);
+    const uint8_t *ref = src + table[h] - 1;
+    size_t len;
+
+    if (table[h] == 0 || read32 (ref) != seq)
+    {
+      table[h] = ip - src + 1;
+      ip++;
+      continue;
+    }
+    table[h] = ip - src + 1;
+
+    for (len = LZ_MIN_MATCH; ip + len < end && ref[len] == ip[len]; len++)
+      continue;
+
+    if (!put_sequence (&op, oend, anchor, ip - anchor, ip - ref, len))
+      return 0;
+    ip += len;
+    anchor = ip;
+  }
+
+  if (!put_sequence (&op, oend, anchor, end - anchor, 0, 0))
+    return 0;
+
+  return op - (uint8_t *) dst_;
+}
+
+/* Reads an extra length at *IP, not passing IEND, and adds it
+   to *LEN.  Returns false if the input ends first. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+  uint8_t b;
+
+  do
+  {
+    if (*ip >= iend) return false;
+    b = *(*ip)++;
+    *len += b;
+  }
+  while (b == 255);
+
+  return true;
+}
+
+/* Decompresses the N bytes at SRC into the CAP bytes at DST.
+   Returns the decompressed size, or 0 if SRC is corrupt or
+   would expand to more than CAP bytes. */
+size_t
+lz_decompress (const void *src, size_t n, void *dst_, size_t cap)
+{
+  const uint8_t *ip = src, *iend = ip + n;
+  uint8_t *dst = dst_, *op = dst, *oend = dst + cap;
+
+  while (ip < iend)
+  {
+    uint8_t token = *ip++;
+    size_t lit_cnt = token >> 4;
+    size_t len = token & 0xf;
+    size_t offset;
+
+    if (lit_cnt == 15 && !get_length (&ip, iend, &lit_cnt))
+      return 0;
+    if ((size_t) (iend - ip) < lit_cnt || (size_t) (oend - op) < lit_cnt)
+      return 0;
+    memcpy (op, ip, lit_cnt);
+    ip += lit_cnt;
+    op += lit_cnt;
+
+    /* The last sequence has no match. */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2) return 0;
+    offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    if (len == 15 && !get_length (&ip, iend, &len))
+      return 0;
+    len += LZ_MIN_MATCH;
+
+    if (offset == 0 || offset > (size_t) (op - dst)
+        || (size_t) (oend - op) < len)
+      return 0;
+
+    /* Byte by byte, since the match may overlap its own output. */
+    for (; len > 0; len--, op++)
+      *op = op[-offset];
+  }
+
+  return op - dst;
+}
@@ -0,0 +1,17 @@
+#ifndef FILESYS_LZ_H
+#define FILESYS_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest input lz_compress() accepts. */
+#define LZ_MAX_INPUT 65535
+
+/* Size of the scratch area lz_compress() needs. */
+#define LZ_WORK_SIZE (4096 * sizeof (uint16_t))
+
+size_t lz_compress (const void *src, size_t n, void *dst, size_t cap,
+                    void *work);
+size_t lz_decompress (const void *src, size_t n, void *dst, size_t cap);
+
+#endif /* filesys/lz.h */
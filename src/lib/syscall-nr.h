@@ -28,7 +28,32 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_PREALLOCATE,            /* Reserves disk space for a file. */
+    SYS_DEFRAG,                 /* Makes a file contiguous on disk. */
+    SYS_CREATE_FLAGS,           /* Creates a file with options. */
+    SYS_CLONE,                  /* Creates a copy-on-write copy of a file. */
+    SYS_FADVISE,                /* Sets an access hint for a file. */
+    SYS_PREAD,                  /* Read from a file at an offset. */
+    SYS_PWRITE,                 /* Write to a file at an offset. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_COPY_RANGE,             /* Copy data between files in the kernel. */
+    SYS_READDIRPLUS,            /* Reads directory entries with metadata. */
+    SYS_OPENAT,                 /* Opens a file relative to a directory. */
+    SYS_CREATEAT,               /* Creates a file relative to a directory. */
+    SYS_MKDIRAT,                /* Creates a directory relative to a directory. */
+    SYS_REMOVEAT,               /* Deletes a file relative to a directory. */
+    SYS_FSYNC,                  /* Writes a file's data to disk. */
+    SYS_SYNC,                   /* Writes all file system data to disk. */
+    SYS_RING_SETUP,             /* Registers submission/completion rings. */
+    SYS_RING_ENTER,             /* Runs queued ring operations. */
+    SYS_AIO_READ,               /* Starts reading from a file. */
+    SYS_AIO_WRITE,              /* Starts writing to a file. */
+    SYS_AIO_POLL,               /* Checks whether an aio request is done. */
+    SYS_AIO_WAIT                /* Waits for an aio request to finish. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -45,4 +46,127 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+
+/* create_flags() flags. */
+#define CREATE_COMPRESSED 0x1   /* Store the file's data compressed. */
+
+bool create_flags (const char *file, unsigned initial_size, unsigned flags);
+bool preallocate (int fd, unsigned offset, unsigned length);
+bool defrag (int fd);
+bool clone (int fd, const char *file);
+
+/* fadvise() hints. */
+#define FADV_NORMAL 0           /* No hint. */
+#define FADV_SEQUENTIAL 1       /* Will be read in order. */
+#define FADV_RANDOM 2           /* Will be read in no particular order. */
+#define FADV_WILLNEED 3         /* Will be read soon. */
+#define FADV_DONTNEED 4         /* Will not be read soon. */
+#define FADV_NOREUSE 5          /* Will be read only once. */
+
+bool fadvise (int fd, int advice);
+
+/* One buffer for readv() and writev(). */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+/* Most buffers passed to one readv() or writev(). */
+#define IOV_MAX 64
+
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_range (int in_fd, int out_fd, unsigned length);
+
+/* One directory entry returned by readdirplus(). */
+struct readdir_entry
+  {
+    int inumber;                /* Inode number. */
+    unsigned length;            /* Size in bytes. */
+    char name[16];              /* Null-terminated file name. */
+    bool isdir;                 /* Directory? */
+  };
+
+int readdirplus (int fd, struct readdir_entry *entries, int max);
+
+/* Like open(), create(), mkdir() and remove(), but resolve a
+   relative name from the directory open as DIRFD. */
+int openat (int dirfd, const char *file);
+bool createat (int dirfd, const char *file, unsigned initial_size);
+bool mkdirat (int dirfd, const char *dir);
+bool removeat (int dirfd, const char *file);
+
+bool fsync (int fd);
+void sync (void);
+
+/* Operations queued on a submission ring. */
+#define RING_READ 0             /* read (fd, buf, len). */
+#define RING_WRITE 1            /* write (fd, buf, len). */
+#define RING_OPEN 2             /* open (buf); len and fd unused. */
+#define RING_CLOSE 3            /* close (fd); result is 0. */
+#define RING_PREAD 4            /* pread (fd, buf, len, offset). */
+#define RING_PWRITE 5           /* pwrite (fd, buf, len, offset). */
+
+/* Entries in each ring.  A power of 2. */
+#define RING_ENTRIES 128
+
+/* One queued operation. */
+struct ring_sqe
+  {
+    int op;                     /* RING_* operation. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer, or file name for RING_OPEN. */
+    unsigned len;               /* Length of BUF in bytes. */
+    unsigned offset;            /* File offset for RING_PREAD/PWRITE. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+
+/* One completed operation. */
+struct ring_cqe
+  {
+    unsigned user_data;         /* From the submission. */
+    int res;                    /* What the plain system call returns. */
+  };
+
+/* Submission ring.  The process fills sqes[tail % RING_ENTRIES]
+   and then advances TAIL; the kernel advances HEAD as it takes
+   entries.  Both indexes run freely and wrap around. */
+struct ring_sq
+  {
+    unsigned head;
+    unsigned tail;
+    struct ring_sqe sqes[RING_ENTRIES];
+  };
+
+/* Completion ring.  The kernel fills cqes[tail % RING_ENTRIES]
+   and then advances TAIL; the process advances HEAD as it reaps
+   entries. */
+struct ring_cq
+  {
+    unsigned head;
+    unsigned tail;
+    struct ring_cqe cqes[RING_ENTRIES];
+  };
+
+bool ring_setup (struct ring_sq *sq, struct ring_cq *cq);
+int ring_enter (unsigned to_submit);
+
+/* Asynchronous I/O.  aio_read() and aio_write() start a
+   transfer at OFFSET in FD, like pread() and pwrite(), and return
+   a request id at once, or -1 on failure.  BUFFER must not be
+   touched until aio_wait() has returned for the id; a read's
+   data lands in BUFFER during aio_wait().  aio_poll() tells
+   whether aio_wait() would return without blocking. */
+#define AIO_MAX 16              /* Most requests in flight at once. */
+#define AIO_MAX_SIZE 16384      /* Most bytes in one request. */
+
+int aio_read (int fd, void *buffer, unsigned size, unsigned offset);
+int aio_write (int fd, const void *buffer, unsigned size, unsigned offset);
+bool aio_poll (int id);
+int aio_wait (int id);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,57 @@
+/* Writes a file with aio_write(), reads it back with aio_read()
+   and checks it, then runs a child that exits with requests
+   still in flight and checks that the file system survives. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK_CNT 8
+
+static char buf[CHUNK_CNT * AIO_MAX_SIZE];
+static char in[CHUNK_CNT * AIO_MAX_SIZE];
+
+void
+test_main (void)
+{
+  int ids[CHUNK_CNT];
+  pid_t child;
+  int fd;
+  int i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+
+  msg ("aio_write %d chunks of %d bytes", CHUNK_CNT, AIO_MAX_SIZE);
+  for (i = 0; i < CHUNK_CNT; i++)
+    if ((ids[i] = aio_write (fd, buf + i * AIO_MAX_SIZE, AIO_MAX_SIZE,
+                             i * AIO_MAX_SIZE)) < 0)
+      fail ("aio_write chunk %d failed", i);
+  for (i = 0; i < CHUNK_CNT; i++)
+    if (aio_wait (ids[i]) != AIO_MAX_SIZE)
+      fail ("aio_wait for write of chunk %d failed", i);
+  CHECK (filesize (fd) == sizeof buf, "filesize \"data\"");
+
+  msg ("aio_read %d chunks of %d bytes", CHUNK_CNT, AIO_MAX_SIZE);
+  for (i = CHUNK_CNT - 1; i >= 0; i--)
+    if ((ids[i] = aio_read (fd, in + i * AIO_MAX_SIZE, AIO_MAX_SIZE,
+                            i * AIO_MAX_SIZE)) < 0)
+      fail ("aio_read chunk %d failed", i);
+  for (i = 0; i < CHUNK_CNT; i++)
+    if (aio_wait (ids[i]) != AIO_MAX_SIZE)
+      fail ("aio_wait for read of chunk %d failed", i);
+  compare_bytes (in, buf, sizeof in, 0, "data");
+  CHECK (aio_wait (ids[0]) == -1, "aio_wait on a collected id fails");
+  msg ("close \"data\"");
+  close (fd);
+
+  CHECK ((child = exec ("child-aio-exit")) != -1, "exec \"child-aio-exit\"");
+  CHECK (wait (child) == 0, "wait for \"child-aio-exit\"");
+
+  msg ("check \"data\" after child exit");
+  check_file ("data", buf, sizeof buf);
+}
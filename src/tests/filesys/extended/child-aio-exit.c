@@ -0,0 +1,31 @@
+/* Child process for aio-rw.
+   Rewrites "data" with the same contents through as many aio
+   requests as it may have in flight, and exits without waiting
+   for any of them. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-aio-exit";
+
+static char buf[AIO_MAX * 1024];
+
+int
+main (void)
+{
+  int fd;
+  int i;
+
+  quiet = true;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  for (i = 0; i < AIO_MAX; i++)
+    CHECK (aio_write (fd, buf + i * 1024, 1024, i * 1024) >= 0,
+           "aio_write %d", i);
+
+  return 0;
+}
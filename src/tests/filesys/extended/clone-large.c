@@ -0,0 +1,80 @@
+/* Clones a 4 MB sparse file, which has one level-1 index block
+   for every 64 kB, far more than fit in one journal transaction,
+   and checks that the clone reads back the same data and that
+   writing the clone leaves the original alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (4 * 1024 * 1024)
+#define STRIDE (64 * 1024)
+#define BLOCK_SIZE 512
+
+static char buf[BLOCK_SIZE];
+static char expected[BLOCK_SIZE];
+
+/* Fills BLOCK with the pattern written at offset OFS. */
+static void
+fill (char *block, int ofs)
+{
+  size_t i;
+
+  for (i = 0; i < BLOCK_SIZE; i++)
+    block[i] = (char) (ofs / STRIDE + i);
+}
+
+/* Checks the blocks at every STRIDE in FD against fill(). */
+static void
+check_blocks (int fd, const char *file_name)
+{
+  int ofs;
+
+  for (ofs = 0; ofs < FILE_SIZE; ofs += STRIDE)
+    {
+      fill (expected, ofs);
+      seek (fd, ofs);
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %d bytes at offset %d in \"%s\" failed",
+              BLOCK_SIZE, ofs, file_name);
+      compare_bytes (buf, expected, BLOCK_SIZE, ofs, file_name);
+    }
+}
+
+void
+test_main (void)
+{
+  int fd, clone_fd;
+  int ofs;
+
+  CHECK (create ("orig", 0), "create \"orig\"");
+  CHECK ((fd = open ("orig")) > 1, "open \"orig\"");
+  msg ("write a block every %d bytes of \"orig\"", STRIDE);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += STRIDE)
+    {
+      fill (buf, ofs);
+      seek (fd, ofs);
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write %d bytes at offset %d in \"orig\" failed",
+              BLOCK_SIZE, ofs);
+    }
+
+  CHECK (clone (fd, "copy"), "clone \"orig\" to \"copy\"");
+  CHECK ((clone_fd = open ("copy")) > 1, "open \"copy\"");
+  CHECK (filesize (clone_fd) == filesize (fd), "compare sizes");
+  msg ("check \"copy\"");
+  check_blocks (clone_fd, "copy");
+
+  msg ("overwrite first block of \"copy\"");
+  memset (buf, 0x5a, BLOCK_SIZE);
+  seek (clone_fd, 0);
+  CHECK (write (clone_fd, buf, BLOCK_SIZE) == BLOCK_SIZE, "write \"copy\"");
+  msg ("check \"orig\"");
+  check_blocks (fd, "orig");
+
+  msg ("close \"copy\"");
+  close (clone_fd);
+  msg ("close \"orig\"");
+  close (fd);
+}
@@ -0,0 +1,46 @@
+/* Builds and tears down a nested tree with openat(), createat(),
+   mkdirat() and removeat(), each resolving from a directory fd. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int a_fd, b_fd, c_fd, f_fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK ((a_fd = open ("a")) > 1, "open \"a\"");
+  CHECK (mkdirat (a_fd, "b"), "mkdirat \"a\", \"b\"");
+  CHECK ((b_fd = openat (a_fd, "b")) > 1, "openat \"a\", \"b\"");
+  CHECK (mkdirat (b_fd, "c"), "mkdirat \"a/b\", \"c\"");
+  CHECK ((c_fd = openat (b_fd, "c")) > 1, "openat \"a/b\", \"c\"");
+  CHECK (createat (c_fd, "f", 100), "createat \"a/b/c\", \"f\"");
+  CHECK (createat (a_fd, "b/c/g", 200), "createat \"a\", \"b/c/g\"");
+
+  CHECK ((f_fd = open ("/a/b/c/f")) > 1, "open \"/a/b/c/f\"");
+  CHECK (filesize (f_fd) == 100, "filesize \"/a/b/c/f\"");
+  msg ("close \"/a/b/c/f\"");
+  close (f_fd);
+  CHECK ((f_fd = openat (c_fd, "g")) > 1, "openat \"a/b/c\", \"g\"");
+  CHECK (filesize (f_fd) == 200, "filesize \"a/b/c/g\"");
+  CHECK (openat (f_fd, "x") == -1, "openat on a file fd fails");
+  msg ("close \"a/b/c/g\"");
+  close (f_fd);
+
+  CHECK (!createat (b_fd, "c", 0), "createat over existing \"c\" fails");
+  CHECK (!removeat (a_fd, "b"), "removeat non-empty \"a/b\" fails");
+  CHECK (removeat (c_fd, "f"), "removeat \"a/b/c\", \"f\"");
+  CHECK (removeat (b_fd, "c/g"), "removeat \"a/b\", \"c/g\"");
+  CHECK (openat (c_fd, "f") == -1, "openat removed \"f\" fails");
+  msg ("close \"a/b/c\"");
+  close (c_fd);
+  CHECK (removeat (b_fd, "c"), "removeat \"a/b\", \"c\"");
+  msg ("close \"a/b\"");
+  close (b_fd);
+  CHECK (removeat (a_fd, "b"), "removeat \"a\", \"b\"");
+  CHECK (open ("/a/b") == -1, "open \"/a/b\" fails");
+  msg ("close \"a\"");
+  close (a_fd);
+}
@@ -0,0 +1,72 @@
+/* Lists a directory holding more entries than one directory
+   sector with readdirplus(), a few entries per call, and checks
+   that every entry comes back exactly once with the right length
+   and type. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 60
+#define BATCH 7
+
+static bool seen[FILE_CNT];
+
+void
+test_main (void)
+{
+  struct readdir_entry entries[BATCH];
+  bool seen_dir = false;
+  int fd, cnt, total = 0;
+  int i;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  CHECK (mkdir ("dir/sub"), "mkdir \"dir/sub\"");
+  msg ("create %d files in \"dir\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char name[32];
+
+      snprintf (name, sizeof name, "dir/f%d", i);
+      if (!create (name, i * 10))
+        fail ("create \"%s\" failed", name);
+    }
+
+  CHECK ((fd = open ("dir")) > 1, "open \"dir\"");
+  msg ("readdirplus \"dir\" %d entries at a time", BATCH);
+  while ((cnt = readdirplus (fd, entries, BATCH)) > 0)
+    {
+      if (cnt > BATCH)
+        fail ("readdirplus returned %d entries, asked for %d", cnt, BATCH);
+      for (i = 0; i < cnt; i++)
+        {
+          struct readdir_entry *e = &entries[i];
+          int n;
+
+          total++;
+          if (!strcmp (e->name, "sub"))
+            {
+              if (seen_dir || !e->isdir)
+                fail ("bad entry for \"sub\"");
+              seen_dir = true;
+              continue;
+            }
+          n = atoi (e->name + 1);
+          if (e->name[0] != 'f' || n < 0 || n >= FILE_CNT)
+            fail ("unexpected entry \"%s\"", e->name);
+          if (seen[n])
+            fail ("entry \"%s\" returned twice", e->name);
+          if (e->isdir || e->length != (unsigned) n * 10)
+            fail ("entry \"%s\" has length %u, expected %d",
+                  e->name, e->length, n * 10);
+          seen[n] = true;
+        }
+    }
+  CHECK (cnt == 0, "readdirplus reached end of \"dir\"");
+  CHECK (total == FILE_CNT + 1, "%d entries returned", FILE_CNT + 1);
+  msg ("close \"dir\"");
+  close (fd);
+}
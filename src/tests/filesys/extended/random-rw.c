@@ -0,0 +1,56 @@
+/* Overwrites small pieces of a file that reaches past the direct
+   pointers at random offsets, rewriting some of them many times,
+   then checks every byte.  In the log-structured layout each
+   overwrite moves data, index blocks and the inode to the log
+   head, so this checks that nothing points at an old copy. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (96 * 1024)
+#define WRITE_SIZE 100
+#define WRITE_CNT 400
+
+static char expected[FILE_SIZE];
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int i;
+
+  random_init (0);
+  random_bytes (expected, sizeof expected);
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, expected, FILE_SIZE) == FILE_SIZE,
+         "write %d bytes to \"data\"", FILE_SIZE);
+
+  msg ("overwrite %d pieces of %d bytes", WRITE_CNT, WRITE_SIZE);
+  for (i = 0; i < WRITE_CNT; i++)
+    {
+      /* Half the writes go to the first few sectors. */
+      unsigned range = i % 2 ? FILE_SIZE : 4 * 512;
+      unsigned ofs = random_ulong () % (range - WRITE_SIZE);
+
+      random_bytes (expected + ofs, WRITE_SIZE);
+      seek (fd, ofs);
+      if (write (fd, expected + ofs, WRITE_SIZE) != WRITE_SIZE)
+        fail ("write %d bytes at offset %u failed", WRITE_SIZE, ofs);
+    }
+
+  msg ("close \"data\"");
+  close (fd);
+
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (read (fd, buf, FILE_SIZE) == FILE_SIZE,
+         "read %d bytes from \"data\"", FILE_SIZE);
+  compare_bytes (buf, expected, FILE_SIZE, 0, "data");
+  msg ("close \"data\"");
+  close (fd);
+}
@@ -0,0 +1,79 @@
+/* Opens, writes, reads back and closes a file through the
+   submission and completion rings, including one entry with a
+   bad buffer, which fails alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct ring_sq sq;
+static struct ring_cq cq;
+static char out[1024];
+static char in[1024];
+
+/* Queues an operation on the submission ring. */
+static void
+queue (int op, int fd, void *buf, unsigned len, unsigned offset,
+       unsigned user_data)
+{
+  struct ring_sqe *sqe = &sq.sqes[sq.tail % RING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = len;
+  sqe->offset = offset;
+  sqe->user_data = user_data;
+  sq.tail++;
+}
+
+/* Takes the next completion, which must be for USER_DATA, and
+   returns its result. */
+static int
+reap (unsigned user_data)
+{
+  struct ring_cqe *cqe;
+
+  if (cq.head == cq.tail)
+    fail ("completion ring empty, expected entry %u", user_data);
+  cqe = &cq.cqes[cq.head++ % RING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("completion for entry %u, expected %u", cqe->user_data, user_data);
+  return cqe->res;
+}
+
+void
+test_main (void)
+{
+  static char name[] = "data";
+  int fd;
+  size_t i;
+
+  for (i = 0; i < sizeof out; i++)
+    out[i] = (char) (i * 13);
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK (ring_setup (&sq, &cq), "ring_setup");
+
+  queue (RING_OPEN, 0, name, 0, 0, 1);
+  CHECK (ring_enter (1) == 1, "ring_enter open");
+  CHECK ((fd = reap (1)) > 1, "open through the ring");
+
+  queue (RING_PWRITE, fd, out, 512, 0, 2);
+  queue (RING_PWRITE, fd, out + 512, 512, 512, 3);
+  queue (RING_READ, fd, (void *) 0xc0000000, 16, 0, 4);
+  queue (RING_PREAD, fd, in, sizeof in, 0, 5);
+  queue (RING_CLOSE, fd, NULL, 0, 0, 6);
+  CHECK (ring_enter (5) == 5, "ring_enter 5 entries");
+  CHECK (reap (2) == 512, "first pwrite");
+  CHECK (reap (3) == 512, "second pwrite");
+  CHECK (reap (4) == -1, "read into kernel memory fails");
+  CHECK (reap (5) == (int) sizeof in, "pread");
+  CHECK (reap (6) == 0, "close");
+  CHECK (cq.head == cq.tail, "completion ring drained");
+  compare_bytes (in, out, sizeof in, 0, name);
+
+  CHECK (ring_setup (NULL, NULL), "unregister rings");
+  CHECK (ring_enter (1) == -1, "ring_enter without rings fails");
+}
@@ -32,7 +32,8 @@ usage (void)
   exit (EXIT_FAILURE);
 }
 
-static bool archive_file (char file_name[], size_t file_name_size,
+static bool archive_file (int dir_fd, const char *entry,
+                          char file_name[], size_t file_name_size,
                           int archive_fd, bool *write_error);
 
 static bool archive_ordinary_file (const char *file_name, int file_fd,
@@ -72,7 +73,7 @@ make_tar_archive (const char *archive_name, char *files[], size_t file_cnt)
       char file_name[128];
       
       strlcpy (file_name, files[i], sizeof file_name);
-      if (!archive_file (file_name, sizeof file_name,
+      if (!archive_file (-1, file_name, file_name, sizeof file_name,
                          archive_fd, &write_error))
         success = false;
     }
@@ -86,12 +87,16 @@ make_tar_archive (const char *archive_name, char *files[], size_t file_cnt)
   return success;
 }
 
+/* Archives FILE_NAME, which is opened as ENTRY relative to the
+   directory open as DIR_FD, or by its full name if DIR_FD is
+   -1, so that each file costs one path component to open. */
 static bool
-archive_file (char file_name[], size_t file_name_size,
+archive_file (int dir_fd, const char *entry,
+              char file_name[], size_t file_name_size,
               int archive_fd, bool *write_error) 
 {
   //printf("archive file : %s\n", file_name);
-  int file_fd = open (file_name);
+  int file_fd = dir_fd < 0 ? open (file_name) : openat (dir_fd, entry);
   if (file_fd >= 0) 
     {
       bool success;
@@ -177,7 +182,8 @@ archive_directory (char file_name[], size_t file_name_size, int file_fd,
       
   file_name[dir_len] = '/';
   while (readdir (file_fd, &file_name[dir_len + 1])) 
-    if (!archive_file (file_name, file_name_size, archive_fd, write_error))
+    if (!archive_file (file_fd, &file_name[dir_len + 1], file_name,
+                       file_name_size, archive_fd, write_error))
       success = false;
   file_name[dir_len] = '\0';
 
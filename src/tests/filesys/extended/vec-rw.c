@@ -0,0 +1,78 @@
+/* Tests pread() and pwrite(), which leave the file position
+   alone, and readv() and writev(), including writev() to the
+   console. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char head[100];
+static char body[3000];
+static char tail[700];
+static char in[sizeof head + sizeof body + sizeof tail];
+static char expected[sizeof in];
+
+void
+test_main (void)
+{
+  static const char greeting[] = "vec-rw: hello, ";
+  static const char subject[] = "console\n";
+  struct iovec out_iov[3], in_iov[3];
+  struct iovec con_iov[2];
+  char byte;
+  int fd;
+  size_t i;
+
+  for (i = 0; i < sizeof expected; i++)
+    expected[i] = (char) (i * 7 + 3);
+  memcpy (head, expected, sizeof head);
+  memcpy (body, expected + sizeof head, sizeof body);
+  memcpy (tail, expected + sizeof head + sizeof body, sizeof tail);
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+
+  out_iov[0].iov_base = head;
+  out_iov[0].iov_len = sizeof head;
+  out_iov[1].iov_base = body;
+  out_iov[1].iov_len = sizeof body;
+  out_iov[2].iov_base = tail;
+  out_iov[2].iov_len = sizeof tail;
+  CHECK (writev (fd, out_iov, 3) == (int) sizeof expected,
+         "writev %zu bytes to \"data\"", sizeof expected);
+  CHECK (tell (fd) == sizeof expected, "tell after writev");
+
+  seek (fd, 0);
+  in_iov[0].iov_base = in;
+  in_iov[0].iov_len = 1000;
+  in_iov[1].iov_base = in + 1000;
+  in_iov[1].iov_len = 1;
+  in_iov[2].iov_base = in + 1001;
+  in_iov[2].iov_len = sizeof in - 1001;
+  CHECK (readv (fd, in_iov, 3) == (int) sizeof in,
+         "readv %zu bytes from \"data\"", sizeof in);
+  compare_bytes (in, expected, sizeof in, 0, "data");
+
+  msg ("pwrite and pread at offset 1234");
+  seek (fd, 10);
+  byte = 'x';
+  CHECK (pwrite (fd, &byte, 1, 1234) == 1, "pwrite 1 byte");
+  byte = 0;
+  CHECK (pread (fd, &byte, 1, 1234) == 1, "pread 1 byte");
+  CHECK (byte == 'x', "pread returned the byte pwrite wrote");
+  CHECK (tell (fd) == 10, "file position unchanged");
+  CHECK (pread (fd, in, 100, sizeof expected) == 0, "pread at end of file");
+
+  con_iov[0].iov_base = (void *) greeting;
+  con_iov[0].iov_len = strlen (greeting);
+  con_iov[1].iov_base = (void *) subject;
+  con_iov[1].iov_len = strlen (subject);
+  CHECK (writev (STDOUT_FILENO, con_iov, 2)
+         == (int) (strlen (greeting) + strlen (subject)),
+         "writev to the console");
+
+  msg ("close \"data\"");
+  close (fd);
+}
@@ -48,6 +48,9 @@ uint32_t *base_page_dir;
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
+
+/* -f=log: Format with the log-structured layout? */
+static bool format_log;
 #endif
 
 /* -q: Power off after kernel tasks complete? */
@@ -118,7 +121,7 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   disk_init ();
-  filesys_init (format_filesys);
+  filesys_init (format_filesys, format_log);
 #endif
 
   frame_init ();
@@ -247,7 +250,10 @@ parse_options (char **argv)
         power_off_when_done = true;
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          format_filesys = true;
+          format_log = value != NULL && !strcmp (value, "log");
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -302,6 +308,8 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"put", 2, fsutil_put},
       {"get", 2, fsutil_get},
+      {"defrag", 2, fsutil_defrag},
+      {"extract", 1, fsutil_extract},
 #endif
       {NULL, 0, NULL},
     };
@@ -348,14 +356,17 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  defrag FILE        Make FILE contiguous on disk.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  put FILE           Put FILE into file system from scratch disk.\n"
           "  get FILE           Get FILE from file system into scratch disk.\n"
+          "  extract            Extract ustar archive from scratch disk.\n"
 #endif
           "\nOptions:\n"
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+          "  -f=log             Format with the log-structured layout.\n"
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
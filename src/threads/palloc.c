@@ -125,14 +125,14 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
         struct page_pointer *pp = list_entry (list_front (&now->refer_pages), struct page_pointer, elem);
         struct page *p = page_lookup (pp->thread, pp->addr);  
 
+        /* Clean file-backed pages, including all code pages,
+           are just dropped.  Only mmap pages can be dirty. */
         if (p->fromDisk == true)
         {
           if (pagedir_is_dirty (pp->thread->pagedir, pp->addr))
           {
             struct file *file = p->file;
-            int pos = file_tell (file);
             int written = file_write_at (file, pages+PGSIZE*i,p->file_size, p->file_start);
-            file_seek(file, pos);
             ASSERT (written == p->file_size);
           }
 
@@ -222,6 +222,15 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the first page of the user pool and stores the number
+   of pages in it in *PAGE_CNT. */
+void *
+palloc_user_pool (size_t *page_cnt)
+{
+  *page_cnt = bitmap_size (user_pool.used_map);
+  return user_pool.base;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -1,5 +1,6 @@
 #include "threads/thread.h"
 #include <debug.h>
+#include <bitmap.h>
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
@@ -305,6 +306,10 @@ thread_exit (void)
 
   int tmp[hash_size (&cur->pages)];
   int tmp_idx = 0;
+
+  // aio requests, which need file_lock to finish
+  aio_exit ();
+
   bool isLockAcquired = false;
   if (lock_held_by_current_thread (&file_lock) == false)
   {
@@ -316,7 +321,7 @@ thread_exit (void)
   dir_close (cur->cwd);
 
   // file close
-  for (i = 0; i < cur->fd_idx; i++)
+  for (i = 2; i < cur->fd_idx; i++)
   {
     if (cur->files[i] != NULL) 
     {
@@ -339,19 +344,10 @@ thread_exit (void)
     palloc_free_page (dc);
   }
 
-  // empty_fd_list 
-  while (list_empty (&cur->empty_fd_list) == false)
-  {
-    struct empty_fd *ef = list_entry (list_pop_front (&cur->empty_fd_list), struct empty_fd, fd_elem);
-    palloc_free_page (ef);
-  }
+  // fd table
+  free (cur->files);
+  bitmap_destroy (cur->fd_map);
   
-  // empty_mmap_list 
-  while (list_empty (&cur->empty_mmap_list) == false)
-  {
-    struct empty_mmap *ef = list_entry (list_pop_front (&cur->empty_mmap_list), struct empty_mmap, mmap_elem);
-    palloc_free_page (ef);
-  }
 
   hash_first (&it, &cur->pages);
   hash_next (&it);
@@ -573,11 +569,16 @@ init_thread (struct thread *t, const char *name, int priority)
   sema_init(&t->end_sema, 0);
 
   t->load_success = false;
-  list_init(&t->empty_fd_list);
   t->fd_idx = 2;
-
-  list_init(&t->empty_mmap_list);
-  t->mmap_idx = 0;
+  t->fd_cap = 0;
+  t->files = NULL;
+  t->fd_map = NULL;
+  t->ring_sq = NULL;
+  t->ring_cq = NULL;
+
+  list_init(&t->aio_list);
+  t->aio_cnt = 0;
+  t->aio_next_id = 0;
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -26,7 +26,6 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
-#define MAX_FILE 32
 #define MAX_CWD_LENGTH 128
 
 /* A kernel thread or user process.
@@ -109,9 +108,17 @@ struct thread
 
     int exit_status;
 
-    int fd_idx;
-    struct file_info *files[MAX_FILE];
-    struct list empty_fd_list;
+    int fd_idx;                         /* One past the highest fd used. */
+    int fd_cap;                         /* Slots in FILES and FD_MAP. */
+    struct file_info **files;           /* Open files, indexed by fd. */
+    struct bitmap *fd_map;              /* Fds in use, set bit per fd. */
+
+    struct ring_sq *ring_sq;            /* Submission ring, if any. */
+    struct ring_cq *ring_cq;            /* Completion ring, if any. */
+
+    struct list aio_list;               /* Unreaped aio requests. */
+    int aio_cnt;                        /* Entries in AIO_LIST. */
+    int aio_next_id;                    /* Id for the next aio request. */
 
     struct semaphore create_sema;
     struct semaphore end_sema;
@@ -122,10 +129,6 @@ struct thread
 
     struct hash pages;
 
-    int mmap_idx;
-    int mmap_list[MAX_FILE];
-    struct list empty_mmap_list;
-
     struct dir *cwd;
     void *esp;
 
@@ -151,18 +154,6 @@ struct file_info
   void *mm_addr;
 };
 
-struct empty_fd
-{
-  int fd;
-  struct list_elem fd_elem;
-};
-
-struct empty_mmap
-{
-  int mapid;
-  struct list_elem mmap_elem;
-};
-
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -1,6 +1,7 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "filesys/file.h"
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -200,10 +201,7 @@ page_fault (struct intr_frame *f)
     } 
     ASSERT (success == true);
 
-    int pos = file_tell (p->file);
-    file_seek( p->file, p->file_start);
-    int written = file_read (p->file, kpage, p->file_size);
-    file_seek( p->file, pos);
+    int written = file_read_at (p->file, kpage, p->file_size, p->file_start);
 
     ASSERT (p->file_size == written);
 
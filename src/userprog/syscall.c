@@ -1,15 +1,23 @@
 #include "userprog/syscall.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/init.h"
 
 #include "userprog/process.h"
+#include "userprog/pagedir.h"
 #include "devices/input.h"
 #include "filesys/filesys.h"
+#include "filesys/file.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
+#include "threads/malloc.h"
+#include <bitmap.h>
 
 #include "vm/frame.h"
 #include "vm/page.h"
@@ -18,6 +26,9 @@
 #define MAX_CONSOLE_WRITE 400
 #define MIN(a, b) (((a) < (b))? (a): (b))
 
+/* create_flags() flags, as in lib/user/syscall.h. */
+#define CREATE_COMPRESSED 0x1
+
 static void syscall_handler (struct intr_frame *);
 
 bool is_valid_address (void *a)
@@ -25,6 +36,41 @@ bool is_valid_address (void *a)
   return (is_user_vaddr(a) && a >= 0);
 }
 
+/* Returns true if the LEN bytes at BUF are all user addresses. */
+static bool
+is_valid_buffer (const void *buf, unsigned len)
+{
+  return (is_valid_address ((void *) buf)
+          && is_valid_address ((void *) ((const uint8_t *) buf + len))
+          && (const uint8_t *) buf + len >= (const uint8_t *) buf);
+}
+
+/* Returns true if every page of the LEN bytes at BUF belongs to
+   the process, either mapped or known to its supplemental page
+   table, and is writable if WRITE is true.  The kernel ignores
+   page protection, so this is the only check that keeps it from
+   writing into a process's code. */
+static bool
+is_valid_pages (const void *buf, unsigned len, bool write)
+{
+  struct thread *t = thread_current ();
+  const uint8_t *upage;
+
+  if (is_valid_buffer (buf, len) == false) return false;
+
+  for (upage = pg_round_down (buf); upage < (const uint8_t *) buf + len;
+       upage += PGSIZE)
+  {
+    struct page *p = page_lookup (t, upage);
+
+    if (p == NULL && pagedir_get_page (t->pagedir, upage) == NULL)
+      return false;
+    if (write == true && p != NULL && p->writable == false)
+      return false;
+  }
+  return true;
+}
+
 bool is_valid_file (int fd)
 {
   if (fd < 2 || fd >= thread_current ()->fd_idx || thread_current ()->files[fd] == NULL) 
@@ -62,10 +108,61 @@ int arg_get (int *p)
   }
 }
 
+/* Asynchronous I/O.
+
+   Worker threads run without the submitting process's page
+   directory, so they cannot touch its buffers.  Each request
+   instead carries a kernel bounce buffer: aio_write() fills it at
+   submission and aio_wait() empties a read's into the process's
+   buffer, both in the process's own context.  Each request also
+   reopens its file, so closing the fd meanwhile is harmless.
+
+   Workers do the transfer without file_lock, owning the file's
+   inode through inode_io_begin() instead, so only other users of
+   the same file wait for it.  The process may unmap its buffer
+   before collecting a read, so aio_wait() checks it again. */
+
+/* Number of worker threads. */
+#define AIO_WORKERS 2
+
+/* Per-process limits, as in lib/user/syscall.h. */
+#define AIO_MAX 16
+#define AIO_MAX_SIZE 16384
+
+struct aio_request
+  {
+    int id;                             /* Id returned to the process. */
+    bool write;                         /* Write instead of read? */
+    struct file *file;                  /* Private handle, closed when done. */
+    void *kbuf;                         /* Kernel bounce buffer. */
+    void *ubuf;                         /* Process buffer for a read. */
+    unsigned size;                      /* Bytes to transfer. */
+    unsigned offset;                    /* File offset. */
+    int result;                         /* Bytes transferred. */
+    bool done;                          /* Finished by a worker? */
+    struct semaphore done_sema;         /* Upped when DONE is set. */
+    struct list_elem queue_elem;        /* In aio_queue. */
+    struct list_elem elem;              /* In owner's aio_list. */
+  };
+
+static struct list aio_queue;           /* Requests waiting for a worker. */
+static struct lock aio_lock;            /* Protects aio_queue. */
+static struct semaphore aio_pending;    /* Counts entries in aio_queue. */
+
+static void aio_worker (void *);
+
 void syscall_init (void) 
 {
+  int i;
+
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
   lock_init(&file_lock);
+
+  list_init (&aio_queue);
+  lock_init (&aio_lock);
+  sema_init (&aio_pending, 0);
+  for (i = 0; i < AIO_WORKERS; i++)
+    thread_create ("aio", PRI_DEFAULT, aio_worker, NULL);
 }
 
 void syscall_halt (void)
@@ -104,7 +201,27 @@ bool syscall_create (const char *file, unsigned int initial_size)
     lock_acquire (&file_lock);
     isLockAcquired = true;
   }
-  bool ret = filesys_create(file, initial_size);
+  bool ret = filesys_create(file, initial_size, 0);
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+ 
+  return ret;
+}
+
+bool syscall_create_flags (const char *file, unsigned int initial_size, unsigned flags)
+{
+  if (file == NULL) 
+  {
+    syscall_exit (-1);
+  }
+  if ((flags & ~CREATE_COMPRESSED) != 0) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+  bool ret = filesys_create(file, initial_size, (flags & CREATE_COMPRESSED) ? INODE_COMPRESSED : 0);
   if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
  
   return ret;
@@ -193,9 +310,10 @@ int syscall_write (int fd, const void *buffer, unsigned size)
   {
     for (i = 0; i < size / MAX_CONSOLE_WRITE; i++)
     {
-      putbuf (buffer, MAX_CONSOLE_WRITE);
+      putbuf ((const char *) buffer + i * MAX_CONSOLE_WRITE, MAX_CONSOLE_WRITE);
     }
-    putbuf (buffer, size % MAX_CONSOLE_WRITE);
+    putbuf ((const char *) buffer + i * MAX_CONSOLE_WRITE, size % MAX_CONSOLE_WRITE);
+    ret = size;
   }
 
   else
@@ -213,7 +331,122 @@ int syscall_write (int fd, const void *buffer, unsigned size)
   return ret;
 }
 
+/* Returns the directory open as FD in the current process, or a
+   null pointer if FD is not an open directory. */
+static struct dir *
+dir_fd_get (int fd)
+{
+  struct thread *t = thread_current ();
+
+  if (fd < 2 || fd >= t->fd_idx || t->files[fd] == NULL) return NULL;
+  if (t->files[fd]->is_dir == false || t->files[fd]->is_closed == true) return NULL;
+  return t->files[fd]->file;
+}
+
+/* Initial number of slots in a process's fd table.  The table
+   doubles each time it fills up. */
+#define FD_TABLE_MIN 16
+
+/* Grows the current process's fd table to hold at least CAP
+   descriptors.  Returns false if memory is exhausted, leaving the
+   table unchanged. */
+static bool
+fd_grow (int cap)
+{
+  struct thread *t = thread_current ();
+  struct file_info **files;
+  struct bitmap *fd_map;
+  int new_cap = t->fd_cap > 0 ? t->fd_cap : FD_TABLE_MIN;
+  int i;
+
+  while (new_cap < cap)
+    new_cap *= 2;
+
+  fd_map = bitmap_create (new_cap);
+  if (fd_map == NULL)
+    return false;
+
+  files = realloc (t->files, new_cap * sizeof *files);
+  if (files == NULL)
+  {
+    bitmap_destroy (fd_map);
+    return false;
+  }
+
+  for (i = t->fd_cap; i < new_cap; i++)
+    files[i] = NULL;
+
+  /* Fds 0 and 1 are the console and never handed out. */
+  bitmap_set_multiple (fd_map, 0, 2, true);
+  for (i = 2; i < t->fd_cap; i++)
+    bitmap_set (fd_map, i, bitmap_test (t->fd_map, i));
+
+  bitmap_destroy (t->fd_map);
+  t->files = files;
+  t->fd_map = fd_map;
+  t->fd_cap = new_cap;
+  return true;
+}
+
+/* Installs INFO at the lowest free fd of the current process and
+   returns that fd, or -1 if the table cannot grow. */
+static int
+fd_alloc (struct file_info *info)
+{
+  struct thread *t = thread_current ();
+  size_t fd = BITMAP_ERROR;
+
+  if (t->fd_map != NULL)
+    fd = bitmap_scan_and_flip (t->fd_map, 2, t->fd_cap - 2, false);
+
+  if (fd == BITMAP_ERROR)
+  {
+    fd = t->fd_cap > 2 ? t->fd_cap : 2;
+    if (!fd_grow (fd + 1))
+      return -1;
+    bitmap_mark (t->fd_map, fd);
+  }
+
+  t->files[fd] = info;
+  if ((int) fd >= t->fd_idx)
+    t->fd_idx = fd + 1;
+  return fd;
+}
+
+/* Releases FD of the current process and its table entry, making
+   it the next candidate for reuse if it is the lowest free fd.
+   FD_IDX stays put, as the high-water mark. */
+static void
+fd_free (int fd)
+{
+  struct thread *t = thread_current ();
+
+  free (t->files[fd]);
+  t->files[fd] = NULL;
+  bitmap_reset (t->fd_map, fd);
+}
+
+static int open_at (struct dir *base, const char *file);
+
 int syscall_open (const char *file)
+{
+  return open_at (NULL, file);
+}
+
+int syscall_openat (int dirfd, const char *file)
+{
+  struct dir *base = dir_fd_get (dirfd);
+
+  if (file == NULL) syscall_exit (-1);
+  if (base == NULL) return -1;
+  return open_at (base, file);
+}
+
+/* Opens FILE, resolving a relative name from directory BASE, or
+   from the current directory if BASE is null, and returns its
+   new file descriptor, or -1 on failure. */
+static int
+open_at (struct dir *base, const char *file)
 {
   int ret;
 
@@ -230,7 +463,7 @@ int syscall_open (const char *file)
   }
 
   bool is_dir = false;
-  void *open_file = filesys_open (file, &is_dir);
+  void *open_file = filesys_open_at (base, file, &is_dir);
 
   if (open_file == NULL)
   {
@@ -241,23 +474,23 @@ int syscall_open (const char *file)
 
   else 
   {
-    struct thread *cur = thread_current();
-    
-    if (list_empty (&cur->empty_fd_list) == true) ret = cur->fd_idx++;
+    struct file_info *info = malloc (sizeof *info);
 
-    else 
+    ret = info != NULL ? fd_alloc (info) : -1;
+    if (ret == -1)
     {
-      struct empty_fd *e = list_entry (list_pop_front (&cur->empty_fd_list), struct empty_fd, fd_elem);
-      ret = e->fd;
-
-      palloc_free_page (e); 
-    }  
+      free (info);
+      if (is_dir) dir_close (open_file);
+      else file_close (open_file);
+    }
 
-    cur->files[ret]= palloc_get_page(0);
-    cur->files[ret]->file = open_file;
-    cur->files[ret]->is_dir = is_dir;
-    cur->files[ret]->is_mapped = false;
-    cur->files[ret]->is_closed = false;
+    else
+    {
+      info->file = open_file;
+      info->is_dir = is_dir;
+      info->is_mapped = false;
+      info->is_closed = false;
+    }
   }
 
   if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
@@ -330,11 +563,9 @@ unsigned syscall_tell (int fd)
 
 void syscall_close (int fd)
 {
-  struct empty_fd *e = palloc_get_page (0);
   struct thread *t = thread_current();
-  ASSERT (e != NULL);
 
-  if (fd < 2 || fd >= thread_current ()->fd_idx) 
+  if (fd < 2 || fd >= thread_current ()->fd_idx || thread_current ()->files[fd] == NULL) 
   {
     return ;
   }
@@ -360,12 +591,7 @@ void syscall_close (int fd)
   if (t->files[fd]->is_mapped == false) 
   {
     file_close (t->files[fd]->file);
-
-    e->fd = fd;
-    list_push_front (&t->empty_fd_list, &e->fd_elem);
-
-    palloc_free_page (t->files[fd]);
-    t->files[fd] = NULL;
+    fd_free (fd);
   }
 
   else 
@@ -376,9 +602,13 @@ void syscall_close (int fd)
   if (isLockAcquired == true) lock_release (&file_lock);
 }
 
+/* Maps FD at ADDR.  A file descriptor holds at most one mapping,
+   whose id is the descriptor itself, so map ids never outnumber
+   open files. */
 int syscall_mmap (int fd, void *addr)
 {
   if (is_valid_file (fd) == false) return -1;
+  if (thread_current ()->files[fd]->is_mapped == true) return -1;
 
   if (pg_ofs (addr) != 0 || is_valid_address(addr) == false || addr < 0x08048000) return -1;
 
@@ -441,22 +671,7 @@ int syscall_mmap (int fd, void *addr)
     cur_addr += PGSIZE;
   }
   
-  int ret = -1;
-  if (list_empty (&t->empty_mmap_list) == true)
-  {
-    t->mmap_list[t->mmap_idx] = fd;
-    ret = t->mmap_idx++;
-  }
-
-  else
-  {
-    struct empty_mmap *e = list_entry (list_pop_front (&t->empty_mmap_list), struct empty_mmap, mmap_elem);
-    ret = e->mapid;
-    
-    palloc_free_page(e);
-
-    t->mmap_list[ret] = fd;
-  }
+  int ret = fd;
 
   file_seek (file, pos);
 
@@ -473,7 +688,10 @@ int syscall_mmap (int fd, void *addr)
 void syscall_munmap (int mapid)
 {
   struct thread *t = thread_current ();
-  int fd = t->mmap_list[mapid];
+  int fd = mapid;
+
+  if (fd < 2 || fd >= t->fd_idx || t->files[fd] == NULL || t->files[fd]->is_mapped == false) return;
+
   struct file_info *file_info = t->files[fd];
   int size = file_info->mm_size;
   void *addr = file_info->mm_addr;
@@ -516,7 +734,6 @@ void syscall_munmap (int mapid)
     addr += PGSIZE;
   }
 
-  t->mmap_list[mapid] = 0;
   file_info->is_mapped = false;
 
   if (file_info->is_closed == true)
@@ -524,11 +741,6 @@ void syscall_munmap (int mapid)
     syscall_close (fd);
   }
 
-  struct empty_mmap *em = palloc_get_page(0);
-
-  em->mapid = t->files[fd]->mapid;
-  list_push_front (&t->empty_mmap_list, &em->mmap_elem);
-
   if (isLockAcquired == true) lock_release (&file_lock);
 }
 
@@ -572,6 +784,668 @@ int syscall_inumber (int fd)
   }
 }
 
+bool syscall_preallocate (int fd, unsigned offset, unsigned length)
+{
+  bool ret;
+
+  if (is_valid_file (fd) == false) return false;
+  if ((int) offset < 0 || (int) length < 0 || (int) (offset + length) < 0) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = file_preallocate (thread_current ()->files[fd]->file, offset, length);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_defrag (int fd)
+{
+  struct inode *inode;
+  bool ret;
+
+  /* Directories are metadata, which inode_defrag() leaves alone. */
+  if (is_valid_file (fd) == false) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  inode = file_get_inode (thread_current ()->files[fd]->file);
+  ret = inode_defrag (inode);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_clone (int fd, const char *file)
+{
+  bool ret;
+
+  if (file == NULL) 
+  {
+    syscall_exit (-1);
+  }
+  if (is_valid_file (fd) == false) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = filesys_clone (file_get_inode (thread_current ()->files[fd]->file), file);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_fadvise (int fd, int advice)
+{
+  /* The FADV_* values of lib/user/syscall.h match enum
+     file_advice. */
+  if (is_valid_file (fd) == false) return false;
+  if (advice < ADVICE_NORMAL || advice > ADVICE_NOREUSE) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  file_advise (thread_current ()->files[fd]->file, advice);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return true;
+}
+
+int syscall_pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  int ret;
+
+  if (is_valid_file (fd) == false) return -1;
+  if ((int) offset < 0 || (int) size < 0) return -1;
+  if (is_valid_pages (buffer, size, true) == false) syscall_exit (-1);
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = file_read_at (thread_current ()->files[fd]->file, buffer, size, offset);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+int syscall_pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  int ret;
+
+  if (is_valid_file (fd) == false) return -1;
+  if ((int) offset < 0 || (int) size < 0) return -1;
+  if (is_valid_pages (buffer, size, false) == false) syscall_exit (-1);
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = file_write_at (thread_current ()->files[fd]->file, buffer, size, offset);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+/* Reads into (or, if WRITE, writes from) the IOVCNT buffers in
+   IOV in turn at FD's position, holding file_lock throughout so
+   the buffers form one operation.  Stops early at a short
+   transfer.  Every buffer is checked before any is touched, and
+   buffers that add up to more than INT_MAX bytes are refused, so
+   the total always fits in the return value.  Returns the total
+   number of bytes transferred, or -1 if nothing could be
+   transferred. */
+static int
+syscall_vec (int fd, const struct iovec *iov, int iovcnt, bool write)
+{
+  size_t total = 0;
+  int ret = 0;
+  int i;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+  if (is_valid_pages (iov, iovcnt * sizeof *iov, false) == false)
+    syscall_exit (-1);
+
+  for (i = 0; i < iovcnt; i++)
+  {
+    if (iov[i].iov_len > (size_t) INT_MAX - total) return -1;
+    total += iov[i].iov_len;
+    if (is_valid_pages (iov[i].iov_base, iov[i].iov_len, !write) == false)
+      syscall_exit (-1);
+  }
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  for (i = 0; i < iovcnt; i++)
+  {
+    int n = write ? syscall_write (fd, iov[i].iov_base, iov[i].iov_len)
+                  : syscall_read (fd, iov[i].iov_base, iov[i].iov_len);
+    if (n < 0)
+    {
+      if (i == 0) ret = -1;
+      break;
+    }
+    ret += n;
+    if ((size_t) n < iov[i].iov_len) break;
+  }
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+int syscall_readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall_vec (fd, iov, iovcnt, false);
+}
+
+int syscall_writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall_vec (fd, iov, iovcnt, true);
+}
+
+int syscall_copy_range (int in_fd, int out_fd, unsigned size)
+{
+  struct thread *t = thread_current ();
+  int ret;
+
+  if (is_valid_file (in_fd) == false || is_valid_file (out_fd) == false) return -1;
+  if ((int) size < 0) return -1;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = file_copy (t->files[out_fd]->file, t->files[in_fd]->file, size);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+int syscall_readdirplus (int fd, void *entries, int max)
+{
+  struct thread *t = thread_current ();
+  struct dir_info *infos = entries;
+  int ret;
+
+  if (fd < 2 || fd >= t->fd_idx || t->files[fd] == NULL) return -1;
+  if (t->files[fd]->is_dir == false || t->files[fd]->is_closed == true) return -1;
+  if (max < 0 || (size_t) max > INT_MAX / sizeof *infos) return -1;
+  if (is_valid_pages (infos, max * sizeof *infos, true) == false)
+    syscall_exit (-1);
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = dir_readdir_plus (t->files[fd]->file, infos, max);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_createat (int dirfd, const char *file, unsigned initial_size)
+{
+  struct dir *base = dir_fd_get (dirfd);
+  bool ret;
+
+  if (file == NULL) syscall_exit (-1);
+  if (base == NULL) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = filesys_create_at (base, file, initial_size, 0);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_mkdirat (int dirfd, const char *dir)
+{
+  struct dir *base = dir_fd_get (dirfd);
+  bool ret;
+
+  if (dir == NULL) syscall_exit (-1);
+  if (base == NULL) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = filesys_mkdir_at (base, dir);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_removeat (int dirfd, const char *file)
+{
+  struct dir *base = dir_fd_get (dirfd);
+  bool ret;
+
+  if (file == NULL) syscall_exit (-1);
+  if (base == NULL) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  ret = filesys_remove_at (base, file);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+bool syscall_fsync (int fd)
+{
+  struct thread *t = thread_current ();
+  struct inode *inode;
+  bool ret;
+
+  /* Directories may be synced too. */
+  if (fd < 2 || fd >= t->fd_idx || t->files[fd] == NULL) return false;
+  if (t->files[fd]->file == NULL || t->files[fd]->is_closed == true) return false;
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  if (t->files[fd]->is_dir)
+    inode = dir_get_inode (t->files[fd]->file);
+  else
+    inode = file_get_inode (t->files[fd]->file);
+  ret = inode_sync (inode);
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+void syscall_sync (void)
+{
+  filesys_sync ();
+}
+
+/* Returns true if STR is a null-terminated string all of whose
+   pages pass is_valid_pages(). */
+static bool
+is_valid_string (const char *str)
+{
+  const char *p;
+
+  for (p = str; ; p++)
+  {
+    if ((p == str || pg_ofs (p) == 0) && is_valid_pages (p, 1, false) == false)
+      return false;
+    if (*p == '\0')
+      return true;
+  }
+}
+
+/* Returns true if the current process's rings still lie in
+   writable pages of its own memory. */
+static bool
+rings_valid (const struct ring_sq *sq, const struct ring_cq *cq)
+{
+  return (is_valid_pages (sq, sizeof *sq, true)
+          && is_valid_pages (cq, sizeof *cq, true));
+}
+
+/* Registers SQ and CQ, in the process's own memory, as its
+   submission and completion rings and empties both.  Every page
+   of both must be writable by the process.  Null pointers
+   unregister the rings. */
+bool syscall_ring_setup (struct ring_sq *sq, struct ring_cq *cq)
+{
+  struct thread *t = thread_current ();
+
+  if (sq == NULL || cq == NULL)
+  {
+    t->ring_sq = NULL;
+    t->ring_cq = NULL;
+    return sq == NULL && cq == NULL;
+  }
+
+  if (rings_valid (sq, cq) == false)
+    syscall_exit (-1);
+
+  sq->head = sq->tail = 0;
+  cq->head = cq->tail = 0;
+  t->ring_sq = sq;
+  t->ring_cq = cq;
+  return true;
+}
+
+/* Carries out submission SQE and returns what the equivalent
+   system call would.  Bad user pointers fail the one operation
+   with -1 instead of killing the process. */
+static int
+ring_run (const struct ring_sqe *sqe)
+{
+  switch (sqe->op)
+  {
+    case RING_READ:
+    case RING_PREAD:
+      if (is_valid_pages (sqe->buf, sqe->len, true) == false) return -1;
+      break;
+    case RING_WRITE:
+    case RING_PWRITE:
+      if (is_valid_pages (sqe->buf, sqe->len, false) == false) return -1;
+      break;
+    case RING_OPEN:
+      if (sqe->buf == NULL || is_valid_string (sqe->buf) == false) return -1;
+      break;
+  }
+
+  switch (sqe->op)
+  {
+    case RING_READ: return syscall_read (sqe->fd, sqe->buf, sqe->len);
+    case RING_WRITE: return syscall_write (sqe->fd, sqe->buf, sqe->len);
+    case RING_OPEN: return syscall_open (sqe->buf);
+    case RING_CLOSE: syscall_close (sqe->fd); return 0;
+    case RING_PREAD: return syscall_pread (sqe->fd, sqe->buf, sqe->len, sqe->offset);
+    case RING_PWRITE: return syscall_pwrite (sqe->fd, sqe->buf, sqe->len, sqe->offset);
+    default: return -1;
+  }
+}
+
+/* Takes up to TO_SUBMIT entries off the current process's
+   submission ring, runs them in order under a single hold of
+   file_lock, and posts one completion for each.  Stops early if
+   the submission ring empties or the completion ring fills up.
+   Returns the number of entries taken, or -1 if no rings are
+   registered.  The process may have unmapped its rings since
+   syscall_ring_setup(), so they are checked again. */
+int syscall_ring_enter (unsigned to_submit)
+{
+  struct thread *t = thread_current ();
+  struct ring_sq *sq = t->ring_sq;
+  struct ring_cq *cq = t->ring_cq;
+  unsigned sq_tail, cq_head;
+  int ret = 0;
+
+  if (sq == NULL || cq == NULL) return -1;
+  if (rings_valid (sq, cq) == false) syscall_exit (-1);
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+
+  /* Sample the indexes the process owns once, so that entries it
+     queues meanwhile wait for the next call. */
+  sq_tail = sq->tail;
+  cq_head = cq->head;
+  barrier ();
+
+  while ((unsigned) ret < to_submit && sq->head != sq_tail
+         && cq->tail - cq_head < RING_ENTRIES)
+  {
+    struct ring_sqe sqe = sq->sqes[sq->head % RING_ENTRIES];
+    struct ring_cqe *cqe = &cq->cqes[cq->tail % RING_ENTRIES];
+
+    sq->head++;
+    cqe->user_data = sqe.user_data;
+    cqe->res = ring_run (&sqe);
+    barrier ();
+    cq->tail++;
+    ret++;
+  }
+
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  return ret;
+}
+
+/* Runs queued aio requests, one at a time, forever. */
+static void
+aio_worker (void *aux UNUSED)
+{
+  for (;;)
+  {
+    struct aio_request *r;
+    struct inode *inode;
+
+    sema_down (&aio_pending);
+    lock_acquire (&aio_lock);
+    r = list_entry (list_pop_front (&aio_queue), struct aio_request, queue_elem);
+    lock_release (&aio_lock);
+
+    inode = file_get_inode (r->file);
+    inode_io_begin (inode, r->write);
+    if (r->write)
+      r->result = file_write_at (r->file, r->kbuf, r->size, r->offset);
+    else
+      r->result = file_read_at (r->file, r->kbuf, r->size, r->offset);
+    inode_io_end (inode);
+
+    lock_acquire (&file_lock);
+    file_close (r->file);
+    r->file = NULL;
+    lock_release (&file_lock);
+
+    r->done = true;
+    sema_up (&r->done_sema);
+  }
+}
+
+/* Starts a transfer of SIZE bytes between FD at OFFSET and
+   BUFFER, in the direction given by WRITE.  Returns the new
+   request's id, or -1 on failure. */
+static int
+aio_submit (int fd, void *buffer, unsigned size, unsigned offset, bool write)
+{
+  struct thread *t = thread_current ();
+  struct aio_request *r;
+
+  if (is_valid_file (fd) == false) return -1;
+  if (size > AIO_MAX_SIZE || t->aio_cnt >= AIO_MAX) return -1;
+  if (is_valid_pages (buffer, size, !write) == false) syscall_exit (-1);
+
+  r = malloc (sizeof *r);
+  if (r == NULL) return -1;
+  r->kbuf = malloc (size > 0 ? size : 1);
+  if (r->kbuf == NULL)
+  {
+    free (r);
+    return -1;
+  }
+
+  bool isLockAcquired = false;
+  if (lock_held_by_current_thread (&file_lock) == false)
+  {
+    lock_acquire (&file_lock);
+    isLockAcquired = true;
+  }
+  r->file = file_reopen (t->files[fd]->file);
+  if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
+
+  if (r->file == NULL)
+  {
+    free (r->kbuf);
+    free (r);
+    return -1;
+  }
+
+  if (write)
+    memcpy (r->kbuf, buffer, size);
+  r->id = t->aio_next_id++ & INT32_MAX;
+  r->write = write;
+  r->ubuf = buffer;
+  r->size = size;
+  r->offset = offset;
+  r->result = -1;
+  r->done = false;
+  sema_init (&r->done_sema, 0);
+  list_push_back (&t->aio_list, &r->elem);
+  t->aio_cnt++;
+
+  lock_acquire (&aio_lock);
+  list_push_back (&aio_queue, &r->queue_elem);
+  lock_release (&aio_lock);
+  sema_up (&aio_pending);
+
+  return r->id;
+}
+
+/* Returns the current process's request with the given ID, or a
+   null pointer if there is none. */
+static struct aio_request *
+aio_find (int id)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->aio_list); e != list_end (&t->aio_list);
+       e = list_next (e))
+  {
+    struct aio_request *r = list_entry (e, struct aio_request, elem);
+    if (r->id == id)
+      return r;
+  }
+  return NULL;
+}
+
+/* Removes finished request R from its owner and frees it. */
+static void
+aio_free (struct aio_request *r)
+{
+  ASSERT (r->done);
+
+  list_remove (&r->elem);
+  thread_current ()->aio_cnt--;
+  free (r->kbuf);
+  free (r);
+}
+
+int syscall_aio_read (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return aio_submit (fd, buffer, size, offset, false);
+}
+
+int syscall_aio_write (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return aio_submit (fd, (void *) buffer, size, offset, true);
+}
+
+/* Returns true if request ID has finished, or does not exist, so
+   that syscall_aio_wait() would not block. */
+bool syscall_aio_poll (int id)
+{
+  struct aio_request *r = aio_find (id);
+
+  return r == NULL || r->done;
+}
+
+/* Waits for request ID to finish and returns the number of bytes
+   it transferred, or -1 if there is no such request.  A read's
+   data is copied into the process's buffer here. */
+int syscall_aio_wait (int id)
+{
+  struct aio_request *r = aio_find (id);
+  int ret;
+
+  if (r == NULL) return -1;
+
+  sema_down (&r->done_sema);
+  ret = r->result;
+  if (r->write == false && ret > 0)
+  {
+    if (is_valid_pages (r->ubuf, ret, true) == false)
+    {
+      aio_free (r);
+      syscall_exit (-1);
+    }
+    memcpy (r->ubuf, r->kbuf, ret);
+  }
+  aio_free (r);
+
+  return ret;
+}
+
+/* Waits for and frees all of the current thread's aio requests,
+   without copying out any data.  Called at thread exit. */
+void aio_exit (void)
+{
+  struct thread *t = thread_current ();
+  bool isLockHeld = lock_held_by_current_thread (&file_lock);
+
+  if (list_empty (&t->aio_list)) return;
+
+  /* The workers need file_lock to finish. */
+  if (isLockHeld == true) lock_release (&file_lock);
+  while (list_empty (&t->aio_list) == false)
+  {
+    struct aio_request *r = list_entry (list_front (&t->aio_list),
+                                        struct aio_request, elem);
+    sema_down (&r->done_sema);
+    aio_free (r);
+  }
+  if (isLockHeld == true) lock_acquire (&file_lock);
+}
+
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
@@ -585,6 +1459,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_EXEC: f->eax = syscall_exec (arg_get(ARG(1))); break;
     case SYS_WAIT: f->eax = syscall_wait (arg_get(ARG(1))); break;
     case SYS_CREATE: f->eax = syscall_create (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_CREATE_FLAGS: f->eax = syscall_create_flags (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
     case SYS_REMOVE: f->eax = syscall_remove (arg_get(ARG(1))); break;
     case SYS_OPEN: f->eax = syscall_open (arg_get(ARG(1))); break;
     case SYS_FILESIZE: f->eax = syscall_filesize (arg_get(ARG(1))); break;
@@ -600,6 +1475,28 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_READDIR: f->eax = syscall_readdir (arg_get(ARG(1)), arg_get(ARG(2))); break;
     case SYS_ISDIR: f->eax = syscall_isdir (arg_get(ARG(1))); break;
     case SYS_INUMBER: f->eax = syscall_inumber (arg_get(ARG(1))); break;
+    case SYS_PREALLOCATE: f->eax = syscall_preallocate (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_DEFRAG: f->eax = syscall_defrag (arg_get(ARG(1))); break;
+    case SYS_CLONE: f->eax = syscall_clone (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_FADVISE: f->eax = syscall_fadvise (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_PREAD: f->eax = syscall_pread (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3)), arg_get(ARG(4))); break;
+    case SYS_PWRITE: f->eax = syscall_pwrite (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3)), arg_get(ARG(4))); break;
+    case SYS_READV: f->eax = syscall_readv (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_WRITEV: f->eax = syscall_writev (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_COPY_RANGE: f->eax = syscall_copy_range (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_READDIRPLUS: f->eax = syscall_readdirplus (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_OPENAT: f->eax = syscall_openat (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_CREATEAT: f->eax = syscall_createat (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3))); break;
+    case SYS_MKDIRAT: f->eax = syscall_mkdirat (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_REMOVEAT: f->eax = syscall_removeat (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_FSYNC: f->eax = syscall_fsync (arg_get(ARG(1))); break;
+    case SYS_SYNC: syscall_sync (); break;
+    case SYS_RING_SETUP: f->eax = syscall_ring_setup (arg_get(ARG(1)), arg_get(ARG(2))); break;
+    case SYS_RING_ENTER: f->eax = syscall_ring_enter (arg_get(ARG(1))); break;
+    case SYS_AIO_READ: f->eax = syscall_aio_read (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3)), arg_get(ARG(4))); break;
+    case SYS_AIO_WRITE: f->eax = syscall_aio_write (arg_get(ARG(1)), arg_get(ARG(2)), arg_get(ARG(3)), arg_get(ARG(4))); break;
+    case SYS_AIO_POLL: f->eax = syscall_aio_poll (arg_get(ARG(1))); break;
+    case SYS_AIO_WAIT: f->eax = syscall_aio_wait (arg_get(ARG(1))); break;
     default: ASSERT(false); break;
   } 
 }
@@ -2,9 +2,62 @@
 #define USERPROG_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct lock file_lock;
 
+/* One buffer for syscall_readv() and syscall_writev(), laid out
+   as in lib/user/syscall.h. */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+/* Most buffers passed to one readv() or writev(). */
+#define IOV_MAX 64
+
+/* Submission and completion rings registered with
+   syscall_ring_setup(), laid out as in lib/user/syscall.h. */
+#define RING_READ 0
+#define RING_WRITE 1
+#define RING_OPEN 2
+#define RING_CLOSE 3
+#define RING_PREAD 4
+#define RING_PWRITE 5
+
+#define RING_ENTRIES 128
+
+struct ring_sqe
+  {
+    int op;                     /* RING_* operation. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer, or file name for RING_OPEN. */
+    unsigned len;               /* Length of BUF in bytes. */
+    unsigned offset;            /* File offset for RING_PREAD/PWRITE. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+
+struct ring_cqe
+  {
+    unsigned user_data;         /* From the submission. */
+    int res;                    /* Result of the operation. */
+  };
+
+struct ring_sq
+  {
+    unsigned head;              /* Next entry for the kernel to take. */
+    unsigned tail;              /* Next entry for the process to fill. */
+    struct ring_sqe sqes[RING_ENTRIES];
+  };
+
+struct ring_cq
+  {
+    unsigned head;              /* Next entry for the process to reap. */
+    unsigned tail;              /* Next entry for the kernel to fill. */
+    struct ring_cqe cqes[RING_ENTRIES];
+  };
+
 void syscall_init (void);
 
 void syscall_halt (void);
@@ -12,6 +65,7 @@ void syscall_exit (int);
 int syscall_exec (const char *);
 int syscall_wait (int);
 bool syscall_create (const char *, unsigned int);
+bool syscall_create_flags (const char *, unsigned int, unsigned);
 bool syscall_remove (const char *);
 int syscall_read (int , void *, unsigned);
 int syscall_write (int , const void *, unsigned);
@@ -27,5 +81,28 @@ bool syscall_mkdir (const char *);
 bool syscall_readdir (int fd, char *name);
 bool syscall_isdir (int fd);
 int inumber (int fd);
+bool syscall_preallocate (int fd, unsigned offset, unsigned length);
+bool syscall_defrag (int fd);
+bool syscall_clone (int fd, const char *file);
+bool syscall_fadvise (int fd, int advice);
+int syscall_pread (int fd, void *buffer, unsigned size, unsigned offset);
+int syscall_pwrite (int fd, const void *buffer, unsigned size, unsigned offset);
+int syscall_readv (int fd, const struct iovec *iov, int iovcnt);
+int syscall_writev (int fd, const struct iovec *iov, int iovcnt);
+int syscall_copy_range (int in_fd, int out_fd, unsigned size);
+int syscall_readdirplus (int fd, void *entries, int max);
+int syscall_openat (int dirfd, const char *file);
+bool syscall_createat (int dirfd, const char *file, unsigned initial_size);
+bool syscall_mkdirat (int dirfd, const char *dir);
+bool syscall_removeat (int dirfd, const char *file);
+bool syscall_fsync (int fd);
+void syscall_sync (void);
+bool syscall_ring_setup (struct ring_sq *sq, struct ring_cq *cq);
+int syscall_ring_enter (unsigned to_submit);
+int syscall_aio_read (int fd, void *buffer, unsigned size, unsigned offset);
+int syscall_aio_write (int fd, const void *buffer, unsigned size, unsigned offset);
+bool syscall_aio_poll (int id);
+int syscall_aio_wait (int id);
+void aio_exit (void);
 
 #endif /* userprog/syscall.h */
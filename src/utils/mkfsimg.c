@@ -0,0 +1,974 @@
+/* mkfsimg.c
+
+   Builds a Pintos file system disk image from a host directory
+   tree, or extracts the files in an image back into a host
+   directory, without booting Pintos.
+
+   The on-disk structures below mirror filesys/inode.c,
+   filesys/directory.c, filesys/free-map.c and filesys/journal.c
+   and must be kept in step with them. */
+
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Disk geometry. */
+#define SECTOR_SIZE 512
+#define DIV_ROUND_UP(X, STEP) (((X) + (STEP) - 1) / (STEP))
+
+/* Reserved sectors. */
+#define FREE_MAP_SECTOR 0
+#define ROOT_DIR_SECTOR 1
+#define JOURNAL_SECTOR 2
+#define JOURNAL_BLOCKS 32
+#define SUPER_SECTOR (JOURNAL_SECTOR + 1 + JOURNAL_BLOCKS)
+#define REFCOUNT_SECTOR (SUPER_SECTOR + 1)
+
+/* Magic numbers. */
+#define INODE_MAGIC 0x494e4f44
+#define JOURNAL_MAGIC 0x4a524e4c
+#define SUPER_MAGIC 0x53555052
+
+/* Inode layout. */
+#define PT_PER_SECTOR (SECTOR_SIZE / sizeof (uint32_t))
+#define INODE_INLINE_MAX 480
+#define DIRECT_CNT (INODE_INLINE_MAX / sizeof (uint32_t))
+#define MAX_SECTORS (DIRECT_CNT + PT_PER_SECTOR * PT_PER_SECTOR)
+#define INODE_INLINE 0x1
+#define INODE_COMPRESSED 0x2
+#define CHUNK_SECTORS 8
+#define CHUNK_SIZE (CHUNK_SECTORS * SECTOR_SIZE)
+
+/* Log-structured layout. */
+#define SEGMENT_SECTORS 64
+#define IMAP_RATIO 8
+#define BLOCK_INODE 0xffffffff
+#define BLOCK_TOP 0xfffffffe
+#define BLOCK_LV1(K) (0x80000000 | (K))
+
+enum file_type
+  {
+    TYPE_FILE,
+    TYPE_DIRECTORY
+  };
+
+/* On-disk inode. */
+struct inode_disk
+  {
+    uint32_t child;
+    int32_t length;
+    uint32_t magic;
+    int32_t type;
+    uint32_t flags;
+    union
+      {
+        uint8_t inline_data[INODE_INLINE_MAX];
+        uint32_t direct[DIRECT_CNT];
+      };
+    int32_t unused[3];
+  };
+
+/* Index block. */
+struct index_block
+  {
+    uint32_t pt[PT_PER_SECTOR];
+  };
+
+/* Directory entry. */
+#define DIR_NAME_MAX 15
+struct dir_entry
+  {
+    uint32_t inode_sector;
+    char name[DIR_NAME_MAX + 1];
+    uint8_t in_use;
+    uint8_t pad[3];
+  };
+
+/* Entries in a freshly formatted root directory. */
+#define ROOT_DIR_ENTRIES 16
+
+/* Journal header. */
+struct journal_header
+  {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t cnt;
+    uint32_t home[JOURNAL_BLOCKS];
+    uint8_t unused[SECTOR_SIZE - 3 * 4 - JOURNAL_BLOCKS * 4];
+  };
+
+/* Superblock. */
+struct super_block
+  {
+    uint32_t magic;
+    uint32_t log;
+    uint32_t log_head;
+    uint32_t refcount;
+    uint32_t warmup_cnt;
+    uint32_t warmup[64];
+    uint32_t log_start;
+    uint32_t imap;
+    uint8_t unused[SECTOR_SIZE - 5 * 4 - 64 * 4 - 2 * 4];
+  };
+
+/* Log segment summary entry. */
+struct summary_entry
+  {
+    uint32_t inumber;
+    uint32_t block;
+  };
+
+_Static_assert (sizeof (struct inode_disk) == SECTOR_SIZE, "inode size");
+_Static_assert (sizeof (struct dir_entry) == 24, "dir_entry size");
+_Static_assert (sizeof (struct journal_header) == SECTOR_SIZE, "journal size");
+_Static_assert (sizeof (struct super_block) == SECTOR_SIZE, "super size");
+_Static_assert (sizeof (struct summary_entry) * SEGMENT_SECTORS == SECTOR_SIZE,
+                "summary size");
+
+static FILE *image;                     /* Image being read or written. */
+static const char *image_name;          /* Its file name. */
+static uint32_t disk_sectors;           /* Size of image in sectors. */
+
+static void
+fail (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+
+/* Prints MSG, formatting as with printf(), plus an error message
+   based on errno if it is nonzero, and exits. */
+static void
+fail (const char *msg, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "mkfsimg: ");
+  va_start (args, msg);
+  vfprintf (stderr, msg, args);
+  va_end (args);
+
+  if (errno != 0)
+    fprintf (stderr, ": %s", strerror (errno));
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/* Reads SECTOR of the image into BUFFER. */
+static void
+read_sector (uint32_t sector, void *buffer)
+{
+  if (sector >= disk_sectors)
+    {
+      errno = 0;
+      fail ("%s: sector %"PRIu32" out of range", image_name, sector);
+    }
+  if (fseeko (image, (off_t) sector * SECTOR_SIZE, SEEK_SET) != 0
+      || fread (buffer, SECTOR_SIZE, 1, image) != 1)
+    fail ("%s: reading sector %"PRIu32, image_name, sector);
+}
+
+/* Writes BUFFER to SECTOR of the image. */
+static void
+write_sector (uint32_t sector, const void *buffer)
+{
+  if (fseeko (image, (off_t) sector * SECTOR_SIZE, SEEK_SET) != 0
+      || fwrite (buffer, SECTOR_SIZE, 1, image) != 1)
+    fail ("%s: writing sector %"PRIu32, image_name, sector);
+}
+
+/* Building an image. */
+
+static uint8_t *free_map;               /* One bit per sector. */
+static size_t free_map_size;            /* Bytes in free_map. */
+static uint32_t next_free;              /* Next sector to hand out. */
+
+/* Hands out CNT consecutive sectors and returns the first.
+   Sectors are handed out in order, so every file is
+   contiguous. */
+static uint32_t
+allocate (uint32_t cnt)
+{
+  uint32_t start = next_free;
+  uint32_t i;
+
+  if (cnt > disk_sectors - next_free)
+    {
+      errno = 0;
+      fail ("%s: image full", image_name);
+    }
+  for (i = start; i < start + cnt; i++)
+    free_map[i / 8] |= 1 << (i % 8);
+  next_free += cnt;
+
+  return start;
+}
+
+/* In the log-structured layout, every file but the ones the free
+   map keeps goes into the log, which starts at log_start and is
+   filled segment by segment, the first sector of each holding
+   its summary.  Files other than the root directory get inode
+   numbers from the inode map, starting at disk_sectors. */
+static bool log_layout;                 /* Building a log-structured image? */
+static uint32_t log_start;              /* First sector of the log. */
+static uint32_t segment;                /* Segment being filled, 0 if none. */
+static struct summary_entry summary[SEGMENT_SECTORS]; /* Its summary. */
+static uint32_t *imap;                  /* Inode map. */
+static uint32_t imap_cnt, imap_used;    /* Entries in imap, entries used. */
+
+/* Returns a new inode number: an inode map entry in the
+   log-structured layout, otherwise a sector for the inode. */
+static uint32_t
+allocate_inumber (void)
+{
+  if (!log_layout)
+    return allocate (1);
+  if (imap_used == imap_cnt)
+    {
+      errno = 0;
+      fail ("%s: inode map full", image_name);
+    }
+  return disk_sectors + imap_used++;
+}
+
+/* Allocates the next sector of the log for BLOCK of inode number
+   INUMBER, as in filesys/inode.c, and records it in the
+   segment's summary, starting a new segment as needed. */
+static uint32_t
+log_allocate (uint32_t inumber, uint32_t block)
+{
+  uint32_t sector;
+
+  if ((next_free - log_start) % SEGMENT_SECTORS == 0)
+    {
+      if (segment != 0)
+        write_sector (segment, summary);
+      if (disk_sectors - next_free < SEGMENT_SECTORS)
+        {
+          errno = 0;
+          fail ("%s: image full", image_name);
+        }
+      segment = allocate (1);
+      memset (summary, 0, sizeof summary);
+    }
+
+  sector = allocate (1);
+  summary[sector - segment].inumber = inumber;
+  summary[sector - segment].block = block;
+  return sector;
+}
+
+/* Returns the sector for BLOCK of inode number INUMBER: the next
+   in the run at *NEXT if NEXT is nonnull, otherwise the next in
+   the log. */
+static uint32_t
+next_block (uint32_t inumber, uint32_t block, uint32_t *next)
+{
+  if (next != NULL)
+    return (*next)++;
+  return log_allocate (inumber, block);
+}
+
+/* Returns the number of sectors, data and index blocks, that a
+   file LENGTH bytes long occupies outside its inode. */
+static uint32_t
+file_sectors (off_t length)
+{
+  uint32_t data, index = 0;
+
+  if (length <= INODE_INLINE_MAX)
+    return 0;
+  data = DIV_ROUND_UP (length, SECTOR_SIZE);
+  if (data > DIRECT_CNT)
+    index = 1 + DIV_ROUND_UP (data - DIRECT_CNT, PT_PER_SECTOR);
+  return data + index;
+}
+
+/* Source of file contents.  Reads up to SIZE bytes into BUFFER
+   and returns the number read; the rest is zero-filled. */
+typedef size_t reader_func (void *aux, void *buffer, size_t size);
+
+/* Reads from a host file. */
+static size_t
+read_stdio (void *file, void *buffer, size_t size)
+{
+  return fread (buffer, 1, size, file);
+}
+
+/* A block of memory being read. */
+struct memory
+  {
+    const uint8_t *data;
+    size_t left;
+  };
+
+/* Reads from a struct memory. */
+static size_t
+read_memory (void *memory_, void *buffer, size_t size)
+{
+  struct memory *memory = memory_;
+
+  if (size > memory->left)
+    size = memory->left;
+  memcpy (buffer, memory->data, size);
+  memory->data += size;
+  memory->left -= size;
+  return size;
+}
+
+/* Fills BUFFER with the next SIZE bytes from READER. */
+static void
+read_block (reader_func *reader, void *aux, uint8_t *buffer, size_t size)
+{
+  size_t n = reader (aux, buffer, size);
+  memset (buffer + n, 0, size - n);
+}
+
+/* Writes the inode of inode number INUMBER for a file of type
+   TYPE, LENGTH bytes long, whose contents come from READER.  The
+   data and index blocks go into the file_sectors(LENGTH) sectors
+   starting at *RUN, or into the log if RUN is null, in the order
+   inode_defrag() produces: direct data, top-level index, then
+   each level-1 index block followed by its data.  An inode
+   number from the inode map gets its inode in the log, after
+   the file's blocks. */
+static void
+write_file (uint32_t inumber, enum file_type type, off_t length,
+            uint32_t *run, reader_func *reader, void *aux)
+{
+  struct inode_disk inode;
+  uint8_t buffer[SECTOR_SIZE];
+  uint32_t data, sector;
+  size_t idx;
+
+  if (length < 0)
+    {
+      errno = 0;
+      fail ("bad file length (%lld bytes)", (long long) length);
+    }
+  if ((size_t) DIV_ROUND_UP (length, SECTOR_SIZE) > MAX_SECTORS)
+    {
+      errno = 0;
+      fail ("file too large (%lld bytes)", (long long) length);
+    }
+
+  memset (&inode, 0, sizeof inode);
+  inode.length = length;
+  inode.magic = INODE_MAGIC;
+  inode.type = type;
+
+  if (length <= INODE_INLINE_MAX)
+    {
+      inode.flags = INODE_INLINE;
+      read_block (reader, aux, inode.inline_data, length);
+    }
+  else
+    {
+      data = DIV_ROUND_UP (length, SECTOR_SIZE);
+      for (idx = 0; idx < data && idx < DIRECT_CNT; idx++)
+        {
+          read_block (reader, aux, buffer, SECTOR_SIZE);
+          inode.direct[idx] = next_block (inumber, idx, run);
+          write_sector (inode.direct[idx], buffer);
+        }
+
+      if (data > DIRECT_CNT)
+        {
+          struct index_block top, lv1;
+          size_t i, j;
+
+          memset (&top, 0, sizeof top);
+          inode.child = next_block (inumber, BLOCK_TOP, run);
+          for (i = 0; idx < data; i++)
+            {
+              memset (&lv1, 0, sizeof lv1);
+              top.pt[i] = next_block (inumber, BLOCK_LV1 (i), run);
+              for (j = 0; j < PT_PER_SECTOR && idx < data; j++, idx++)
+                {
+                  read_block (reader, aux, buffer, SECTOR_SIZE);
+                  lv1.pt[j] = next_block (inumber, idx, run);
+                  write_sector (lv1.pt[j], buffer);
+                }
+              write_sector (top.pt[i], &lv1);
+            }
+          write_sector (inode.child, &top);
+        }
+    }
+
+  sector = inumber;
+  if (inumber >= disk_sectors)
+    {
+      sector = log_allocate (inumber, BLOCK_INODE);
+      imap[inumber - disk_sectors] = sector;
+    }
+  write_sector (sector, &inode);
+}
+
+/* Allocates space for a LENGTH-byte file read from READER and
+   writes it with inode number INUMBER: in the log in the
+   log-structured layout, otherwise in one run of sectors. */
+static void
+put_file (uint32_t inumber, enum file_type type, off_t length,
+          reader_func *reader, void *aux)
+{
+  uint32_t run;
+
+  if (log_layout)
+    write_file (inumber, type, length, NULL, reader, aux);
+  else
+    {
+      run = allocate (file_sectors (length));
+      write_file (inumber, type, length, &run, reader, aux);
+    }
+}
+
+/* Returns false for the "." and ".." entries of a host
+   directory, so that scandir() skips them. */
+static int
+select_entry (const struct dirent *de)
+{
+  return strcmp (de->d_name, ".") && strcmp (de->d_name, "..");
+}
+
+/* Copies host directory PATH into the image as the directory
+   with inode number SECTOR, inside the directory with inode
+   number PARENT.  Each file's inode is placed right before its
+   data, or right after it in the log. */
+static void
+put_dir (const char *path, uint32_t sector, uint32_t parent)
+{
+  struct dirent **names;
+  struct dir_entry *entries;
+  size_t entry_cnt = 0, entry_max;
+  struct memory memory;
+  int name_cnt, i;
+
+  name_cnt = scandir (path, &names, select_entry, alphasort);
+  if (name_cnt < 0)
+    fail ("%s: scandir", path);
+
+  entry_max = name_cnt + 2;
+  if (sector == ROOT_DIR_SECTOR && entry_max < ROOT_DIR_ENTRIES)
+    entry_max = ROOT_DIR_ENTRIES;
+  entries = calloc (entry_max, sizeof *entries);
+  if (entries == NULL)
+    fail ("out of memory");
+
+  entries[entry_cnt].inode_sector = sector;
+  strcpy (entries[entry_cnt++].name, ".");
+  entries[entry_cnt].inode_sector = parent;
+  strcpy (entries[entry_cnt++].name, "..");
+
+  for (i = 0; i < name_cnt; i++)
+    {
+      const char *name = names[i]->d_name;
+      char *child;
+      struct stat st;
+      uint32_t child_sector = 0;
+
+      if (asprintf (&child, "%s/%s", path, name) < 0)
+        fail ("out of memory");
+      if (stat (child, &st) != 0)
+        fail ("%s: stat", child);
+
+      if (strlen (name) > DIR_NAME_MAX)
+        fprintf (stderr, "mkfsimg: %s: name too long, skipped\n", child);
+      else if (S_ISDIR (st.st_mode))
+        {
+          child_sector = allocate_inumber ();
+          put_dir (child, child_sector, sector);
+        }
+      else if (S_ISREG (st.st_mode))
+        {
+          FILE *file = fopen (child, "rb");
+          if (file == NULL)
+            fail ("%s: open", child);
+          child_sector = allocate_inumber ();
+          put_file (child_sector, TYPE_FILE, st.st_size, read_stdio, file);
+          fclose (file);
+        }
+      else
+        fprintf (stderr, "mkfsimg: %s: not a regular file, skipped\n", child);
+
+      if (strlen (name) <= DIR_NAME_MAX
+          && (S_ISDIR (st.st_mode) || S_ISREG (st.st_mode)))
+        {
+          entries[entry_cnt].inode_sector = child_sector;
+          strcpy (entries[entry_cnt].name, name);
+          entries[entry_cnt++].in_use = 1;
+        }
+
+      free (child);
+      free (names[i]);
+    }
+  free (names);
+
+  entries[0].in_use = entries[1].in_use = 1;
+  memory.data = (const uint8_t *) entries;
+  memory.left = entry_max * sizeof *entries;
+  put_file (sector, TYPE_DIRECTORY, memory.left, read_memory, &memory);
+  free (entries);
+}
+
+/* Fills the image, disk_sectors long, with the tree under host
+   directory ROOT, in the log-structured layout if LOG. */
+static void
+build (const char *root, bool log)
+{
+  static const uint8_t zeros[SECTOR_SIZE];
+  struct super_block super;
+  struct memory memory;
+  uint32_t free_map_start, refcount_start, imap_start = 0, imap_inode = 0;
+  uint32_t sector;
+  uint8_t *refcount;
+
+  /* Unused sectors read as zeros. */
+  if (ftruncate (fileno (image), (off_t) disk_sectors * SECTOR_SIZE) != 0)
+    fail ("%s: truncate", image_name);
+
+  free_map_size = DIV_ROUND_UP (disk_sectors, 32) * 4;
+  free_map = calloc (1, free_map_size);
+  refcount = calloc (1, disk_sectors);
+  if (free_map == NULL || refcount == NULL)
+    fail ("out of memory");
+
+  /* Reserved sectors, as in free_map_init(). */
+  allocate (REFCOUNT_SECTOR + 1);
+  for (sector = 0; sector < REFCOUNT_SECTOR + 1; sector++)
+    write_sector (sector, zeros);
+
+  /* The free map and reference count files have fixed sizes,
+     so reserve their space now and fill it in last. */
+  refcount_start = allocate (file_sectors (disk_sectors));
+  free_map_start = allocate (file_sectors (free_map_size));
+
+  /* So does the inode map, and the log starts right after it, as
+     in free_map_create(). */
+  log_layout = log;
+  if (log)
+    {
+      imap_cnt = disk_sectors / IMAP_RATIO;
+      imap = calloc (imap_cnt, sizeof *imap);
+      if (imap == NULL)
+        fail ("out of memory");
+      imap_inode = allocate (1);
+      imap_start = allocate (file_sectors (imap_cnt * sizeof *imap));
+      log_start = next_free;
+    }
+
+  put_dir (root, ROOT_DIR_SECTOR, ROOT_DIR_SECTOR);
+
+  if (log)
+    {
+      if (segment != 0)
+        write_sector (segment, summary);
+      memory.data = (const uint8_t *) imap;
+      memory.left = imap_cnt * sizeof *imap;
+      write_file (imap_inode, TYPE_FILE, memory.left, &imap_start,
+                  read_memory, &memory);
+    }
+
+  memset (&super, 0, sizeof super);
+  super.magic = SUPER_MAGIC;
+  super.log = log;
+  super.log_head = next_free < disk_sectors ? next_free : REFCOUNT_SECTOR + 1;
+  super.refcount = 1;
+  if (log)
+    {
+      super.log_start = log_start;
+      super.log_head = next_free < disk_sectors ? next_free : log_start;
+      super.imap = imap_inode;
+    }
+  write_sector (SUPER_SECTOR, &super);
+
+  memory.data = refcount;
+  memory.left = disk_sectors;
+  write_file (REFCOUNT_SECTOR, TYPE_FILE, disk_sectors, &refcount_start,
+              read_memory, &memory);
+
+  memory.data = free_map;
+  memory.left = free_map_size;
+  write_file (FREE_MAP_SECTOR, TYPE_FILE, free_map_size, &free_map_start,
+              read_memory, &memory);
+
+  printf ("%s: %"PRIu32" of %"PRIu32" sectors used\n",
+          image_name, next_free, disk_sectors);
+  free (refcount);
+  free (free_map);
+  free (imap);
+}
+
+/* Extracting from an image. */
+
+static struct journal_header journal;   /* Journal, for replay. */
+
+/* Reads SECTOR of the image into BUFFER, as it will be once
+   any committed journal transaction has been replayed. */
+static void
+read_fs_sector (uint32_t sector, void *buffer)
+{
+  uint32_t i;
+
+  if (journal.magic == JOURNAL_MAGIC && journal.cnt <= JOURNAL_BLOCKS)
+    for (i = journal.cnt; i-- > 0; )
+      if (journal.home[i] == sector)
+        {
+          read_sector (JOURNAL_SECTOR + 1 + i, buffer);
+          return;
+        }
+  read_sector (sector, buffer);
+}
+
+/* Returns the entry for data sector IDX of INODE, 0 for a hole. */
+static uint32_t
+index_entry (const struct inode_disk *inode, size_t idx)
+{
+  struct index_block block;
+
+  if (idx < DIRECT_CNT)
+    return inode->direct[idx];
+  idx -= DIRECT_CNT;
+  if (idx >= PT_PER_SECTOR * PT_PER_SECTOR || inode->child == 0)
+    return 0;
+
+  read_fs_sector (inode->child, &block);
+  if (block.pt[idx / PT_PER_SECTOR] == 0)
+    return 0;
+  read_fs_sector (block.pt[idx / PT_PER_SECTOR], &block);
+  return block.pt[idx % PT_PER_SECTOR];
+}
+
+/* Decompresses the N bytes at SRC, in the format written by
+   filesys/lz.c, into the CAP bytes at DST.  Returns the
+   decompressed size, or 0 if SRC is corrupt. */
+static size_t
+lz_decompress (const uint8_t *ip, size_t n, uint8_t *dst, size_t cap)
+{
+  const uint8_t *iend = ip + n;
+  uint8_t *op = dst, *oend = dst + cap;
+
+  while (ip < iend)
+    {
+      uint8_t token = *ip++;
+      size_t lit_cnt = token >> 4, len = token & 0xf, offset;
+      uint8_t b;
+
+      if (lit_cnt == 15)
+        do
+          {
+            if (ip >= iend)
+              return 0;
+            lit_cnt += b = *ip++;
+          }
+        while (b == 255);
+      if ((size_t) (iend - ip) < lit_cnt || (size_t) (oend - op) < lit_cnt)
+        return 0;
+      memcpy (op, ip, lit_cnt);
+      ip += lit_cnt;
+      op += lit_cnt;
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return 0;
+      offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      if (len == 15)
+        do
+          {
+            if (ip >= iend)
+              return 0;
+            len += b = *ip++;
+          }
+        while (b == 255);
+      len += 4;
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || (size_t) (oend - op) < len)
+        return 0;
+      for (; len > 0; len--, op++)
+        *op = op[-offset];
+    }
+
+  return op - dst;
+}
+
+/* Reads the CHUNK_SIZE bytes at OFFSET in compressed INODE into
+   BUFFER. */
+static void
+read_chunk (const struct inode_disk *inode, off_t offset, uint8_t *buffer)
+{
+  size_t idx = offset / SECTOR_SIZE;
+  uint32_t start = index_entry (inode, idx);
+  uint32_t size = start != 0 ? index_entry (inode, idx + 1) : 0;
+  uint8_t packed[CHUNK_SIZE];
+  size_t i;
+
+  if (start == 0)
+    memset (buffer, 0, CHUNK_SIZE);
+  else if (size == CHUNK_SIZE)
+    for (i = 0; i < CHUNK_SECTORS; i++)
+      read_fs_sector (start + i, buffer + i * SECTOR_SIZE);
+  else
+    {
+      for (i = 0; i < DIV_ROUND_UP (size, SECTOR_SIZE); i++)
+        read_fs_sector (start + i, packed + i * SECTOR_SIZE);
+      if (lz_decompress (packed, size, buffer, CHUNK_SIZE) != CHUNK_SIZE)
+        {
+          errno = 0;
+          fail ("%s: corrupt compressed chunk at sector %"PRIu32,
+                image_name, start);
+        }
+    }
+}
+
+/* Calls OUTPUT (AUX, DATA, SIZE) for each successive piece of
+   the contents of INODE. */
+static void
+read_file (const struct inode_disk *inode,
+           void (*output) (void *aux, const void *data, size_t size),
+           void *aux)
+{
+  uint8_t buffer[CHUNK_SIZE];
+  off_t offset;
+
+  if (inode->flags & INODE_INLINE)
+    {
+      output (aux, inode->inline_data, inode->length);
+      return;
+    }
+
+  for (offset = 0; offset < inode->length; )
+    {
+      size_t size;
+
+      if (inode->flags & INODE_COMPRESSED)
+        {
+          read_chunk (inode, offset, buffer);
+          size = CHUNK_SIZE;
+        }
+      else
+        {
+          uint32_t sector = index_entry (inode, offset / SECTOR_SIZE);
+          if (sector == 0)
+            memset (buffer, 0, SECTOR_SIZE);
+          else
+            read_fs_sector (sector, buffer);
+          size = SECTOR_SIZE;
+        }
+
+      if (size > (size_t) (inode->length - offset))
+        size = inode->length - offset;
+      output (aux, buffer, size);
+      offset += size;
+    }
+}
+
+/* Writes SIZE bytes of DATA to host file FILE. */
+static void
+output_stdio (void *file, const void *data, size_t size)
+{
+  if (fwrite (data, 1, size, file) != size)
+    fail ("write");
+}
+
+/* A growing block of memory. */
+struct block
+  {
+    uint8_t *data;
+    size_t size;
+  };
+
+/* Appends SIZE bytes of DATA to struct block BLOCK. */
+static void
+output_memory (void *block_, const void *data, size_t size)
+{
+  struct block *block = block_;
+
+  block->data = realloc (block->data, block->size + size);
+  if (block->data == NULL)
+    fail ("out of memory");
+  memcpy (block->data + block->size, data, size);
+  block->size += size;
+}
+
+/* Reads the inode in SECTOR into INODE. */
+static void
+read_inode (uint32_t sector, struct inode_disk *inode)
+{
+  read_fs_sector (sector, inode);
+  if (inode->magic != INODE_MAGIC)
+    {
+      errno = 0;
+      fail ("%s: sector %"PRIu32" is not an inode", image_name, sector);
+    }
+}
+
+/* Reads the inode of inode number INUMBER into INODE, looking it
+   up in the inode map if it has one. */
+static void
+read_inumber (uint32_t inumber, struct inode_disk *inode)
+{
+  uint32_t sector = inumber;
+
+  if (inumber >= disk_sectors)
+    {
+      if (imap == NULL || inumber - disk_sectors >= imap_cnt
+          || imap[inumber - disk_sectors] == 0)
+        {
+          errno = 0;
+          fail ("%s: inode number %"PRIu32" not in use", image_name,
+                inumber);
+        }
+      sector = imap[inumber - disk_sectors];
+    }
+  read_inode (sector, inode);
+}
+
+/* Extracts the directory with inode number SECTOR into host
+   directory PATH, which is created if needed. */
+static void
+get_dir (uint32_t sector, const char *path)
+{
+  struct inode_disk inode;
+  struct block block = { NULL, 0 };
+  size_t i;
+
+  if (mkdir (path, 0777) != 0 && errno != EEXIST)
+    fail ("%s: mkdir", path);
+
+  read_inumber (sector, &inode);
+  read_file (&inode, output_memory, &block);
+
+  for (i = 0; i + sizeof (struct dir_entry) <= block.size;
+       i += sizeof (struct dir_entry))
+    {
+      struct dir_entry e;
+      struct inode_disk child_inode;
+      char *child;
+
+      memcpy (&e, block.data + i, sizeof e);
+      e.name[DIR_NAME_MAX] = '\0';
+      if (!e.in_use || !strcmp (e.name, ".") || !strcmp (e.name, ".."))
+        continue;
+
+      if (asprintf (&child, "%s/%s", path, e.name) < 0)
+        fail ("out of memory");
+      read_inumber (e.inode_sector, &child_inode);
+      if (child_inode.type == TYPE_DIRECTORY)
+        get_dir (e.inode_sector, child);
+      else
+        {
+          FILE *file = fopen (child, "wb");
+          if (file == NULL)
+            fail ("%s: open", child);
+          read_file (&child_inode, output_stdio, file);
+          if (fclose (file) != 0)
+            fail ("%s: close", child);
+        }
+      free (child);
+    }
+
+  free (block.data);
+}
+
+/* Extracts every file in the image into host directory ROOT. */
+static void
+extract (const char *root)
+{
+  struct super_block super;
+
+  read_sector (JOURNAL_SECTOR, &journal);
+
+  /* In the log-structured layout, load the inode map. */
+  read_fs_sector (SUPER_SECTOR, &super);
+  if (super.magic == SUPER_MAGIC && super.log && super.imap != 0)
+    {
+      struct inode_disk inode;
+      struct block block = { NULL, 0 };
+
+      read_inode (super.imap, &inode);
+      read_file (&inode, output_memory, &block);
+      imap = (uint32_t *) block.data;
+      imap_cnt = block.size / sizeof *imap;
+    }
+
+  get_dir (ROOT_DIR_SECTOR, root);
+  free (imap);
+}
+
+static void
+usage (void)
+{
+  printf ("mkfsimg, builds and extracts Pintos file system images\n"
+          "usage: mkfsimg build [--log] IMAGE SIZE DIR\n"
+          "   or: mkfsimg extract IMAGE DIR\n"
+          "  build    creates IMAGE, SIZE sectors long (or SIZE megabytes\n"
+          "           with an M suffix), holding the files under DIR\n"
+          "  extract  copies the files in IMAGE into DIR\n"
+          "  --log    formats with the log-structured layout (-f=log)\n");
+  exit (EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc >= 2 && !strcmp (argv[1], "build"))
+    {
+      bool log = false;
+      char *end;
+      unsigned long long size;
+
+      argv += 2;
+      argc -= 2;
+      if (argc > 0 && !strcmp (argv[0], "--log"))
+        {
+          log = true;
+          argv++;
+          argc--;
+        }
+      if (argc != 3)
+        usage ();
+
+      image_name = argv[0];
+      size = strtoull (argv[1], &end, 10);
+      if (*end == 'M' || *end == 'm')
+        size = size * 1024 * 1024 / SECTOR_SIZE, end++;
+      if (*end != '\0' || size < REFCOUNT_SECTOR + 2 || size >= 1UL << 28)
+        {
+          errno = 0;
+          fail ("%s: bad image size", argv[1]);
+        }
+      disk_sectors = size;
+
+      image = fopen (image_name, "w+b");
+      if (image == NULL)
+        fail ("%s: open", image_name);
+      build (argv[2], log);
+    }
+  else if (argc == 4 && !strcmp (argv[1], "extract"))
+    {
+      struct stat st;
+
+      image_name = argv[2];
+      image = fopen (image_name, "rb");
+      if (image == NULL || fstat (fileno (image), &st) != 0)
+        fail ("%s: open", image_name);
+      disk_sectors = st.st_size / SECTOR_SIZE;
+      extract (argv[3]);
+    }
+  else
+    usage ();
+
+  if (fclose (image) != 0)
+    fail ("%s: close", image_name);
+  return EXIT_SUCCESS;
+}
@@ -1,77 +1,89 @@
 #include "vm/frame.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
 #include "vm/page.h"
 
-unsigned 
-frame_hash (const struct hash_elem *f_, void *aux UNUSED)
-{
-  const struct frame *f = hash_entry (f_, struct frame, elem);
-  return hash_bytes (&f->phy_addr, sizeof f->phy_addr);
-}
-
-bool
-frame_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
-{
-  const struct frame *a = hash_entry (a_, struct frame, elem);
-  const struct frame *b = hash_entry (b_, struct frame, elem);
-
-  return (a->phy_addr < b->phy_addr);
-}
+/* Frame table.  One entry per page of the user pool, indexed by
+   page number within the pool, so finding a frame from its
+   kernel address is a subtraction.  A frame is in use while its
+   REFER_PAGES list is nonempty, and only then is it on
+   frame_list. */
+static struct frame *frames;
+static uint8_t *frame_base;
+static size_t frame_cnt;
+
+/* Reverse-map entries.  There are two per frame, enough for
+   every frame to be shared once, so mapping and unmapping never
+   allocate. */
+static struct page_pointer *pp_pool;
+static struct list pp_free;
 
 void
 frame_init (void)
 {
-  hash_init (&frames, frame_hash, frame_less, NULL);
+  size_t i;
+
+  frame_base = palloc_user_pool (&frame_cnt);
+  frames = calloc (frame_cnt, sizeof *frames);
+  pp_pool = calloc (2 * frame_cnt, sizeof *pp_pool);
+  if (frames == NULL || pp_pool == NULL)
+    PANIC ("frame table allocation failed");
+
+  for (i = 0; i < frame_cnt; i++)
+  {
+    frames[i].phy_addr = frame_base + i * PGSIZE;
+    list_init (&frames[i].refer_pages);
+  }
+
+  list_init (&pp_free);
+  for (i = 0; i < 2 * frame_cnt; i++)
+    list_push_back (&pp_free, &pp_pool[i].elem);
+
   list_init (&frame_list);
   lock_init (&frame_lock);
-  isFirst = true;
+}
+
+/* Returns the frame table entry for PHY_ADDR, in use or not, or
+   a null pointer if PHY_ADDR is not in the user pool. */
+static struct frame *
+frame_lookup (void *phy_addr)
+{
+  size_t idx = ((uint8_t *) phy_addr - frame_base) / PGSIZE;
+
+  if ((uint8_t *) phy_addr < frame_base || idx >= frame_cnt)
+    return NULL;
+  return &frames[idx];
 }
 
 void 
 frame_create (void* phy_addr, void* page_addr)
 {
-  struct frame f;
-  struct hash_elem *e;
+  struct frame *fr = frame_lookup (phy_addr);
   struct page_pointer *pp;
 
-  pp = malloc (sizeof (struct page_pointer));
-  pp->thread = thread_current ();
-  pp->addr = page_addr;
-
-  f.phy_addr = phy_addr;
+  ASSERT (fr != NULL);
 
-  if (e = hash_find (&frames, &f.elem) != NULL)
-  {
-    struct frame *fr = hash_entry (e, struct frame, elem);
-    list_push_back (&fr->refer_pages, &pp->elem);
-  }
-
-  else
-  {
-    struct frame *fr = malloc (sizeof (struct frame));
-  
-    fr->phy_addr = phy_addr;
+  if (list_empty (&pp_free))
+    PANIC ("out of frame reverse-map entries");
 
-    list_init (&fr->refer_pages);
-    list_push_back (&fr->refer_pages, &pp->elem);
+  pp = list_entry (list_pop_front (&pp_free), struct page_pointer, elem);
+  pp->thread = thread_current ();
+  pp->addr = page_addr;
 
-    hash_insert (&frames, &fr->elem);
+  if (list_empty (&fr->refer_pages))
     list_push_back (&frame_list, &fr->list_elem);
-  }
+  list_push_back (&fr->refer_pages, &pp->elem);
 }
 
 struct frame*
 frame_find (void *phy_addr)
 {
-  struct frame f;
-  struct hash_elem *e;
+  struct frame *fr = frame_lookup (phy_addr);
 
-    
-  f.phy_addr = phy_addr;
-  e = hash_find (&frames, &f.elem);
-  return e != NULL ? hash_entry (e, struct frame, elem) : NULL;
+  return fr != NULL && !list_empty (&fr->refer_pages) ? fr : NULL;
 }
 
 void 
@@ -84,51 +96,40 @@ frame_delete (void *phy_addr, bool isForce)
       isLockAcquired = true;
     }
 
-  struct frame f;
   struct frame *fr;
-  struct hash_elem *eh;
   struct list *l;
   struct list_elem *el;
 
-  f.phy_addr = phy_addr;
-
-  eh = hash_find (&frames, &f.elem);
+  fr = frame_find (phy_addr);
 
-  ASSERT (eh != NULL);
+  ASSERT (fr != NULL);
 
-  fr = hash_entry (eh, struct frame, elem);
   l = &fr->refer_pages;
   
   if (isForce == true)
   {
     while (list_empty (l) == false)
-    {
-      struct page_pointer *pp = list_entry (list_pop_front (l), struct page_pointer, elem);
-      free (pp);
-    }
+      list_push_front (&pp_free, list_pop_front (l));
   }
 
   else
   { 
-    for (el = list_begin (l); el != list_end (l); el = list_next (l))
+    for (el = list_begin (l); el != list_end (l); el = list_next (el))
     {
       struct page_pointer *pp = list_entry (el, struct page_pointer, elem);
 
       if (pp->thread == thread_current ()) 
       {
         list_remove (el);
-
-        free (pp);
+        list_push_front (&pp_free, el);
         break;
       }
     }
   }
   
-  if (isForce == true || list_size (l) == 0) 
+  if (list_empty (l)) 
   {
-    hash_delete (&frames, eh);
     list_remove (&fr->list_elem);
-    free (fr);
   }
 
     if (lock_held_by_current_thread (&file_lock) && isLockAcquired == true) lock_release (&file_lock);
@@ -166,8 +167,6 @@ frame_reset_accessed (struct frame *f)
 struct frame* 
 frame_victim ()
 {
-  struct hash_elem *e;
-  
   ASSERT ( list_empty (&frame_list) == false);
 
   while (1)
@@ -175,12 +174,12 @@ frame_victim ()
     struct list_elem *e = list_pop_front (&frame_list);
     struct frame *f = list_entry (e, struct frame, list_elem);
 
-    struct page_pointer *pp = list_entry (list_front (&f->refer_pages), struct page_pointer, elem);
-    struct page *p = page_lookup (pp->thread, pp->addr);
-    
     list_push_back (&frame_list, e);
 
-    if (frame_is_accessed (f) == false && p->fromDisk == false )
+    /* File-backed pages are fair game too: palloc_get_multiple()
+       writes back a dirty mmap page and drops the frame, and the
+       next fault reads the page from its file again. */
+    if (frame_is_accessed (f) == false)
     {
        return f;
     }